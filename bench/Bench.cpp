@@ -0,0 +1,657 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <streambuf>
+#include <unordered_set>
+#include "Converter.hpp"
+#include "Legend.hpp"
+#include "StrHash.hpp"
+
+// Times the stages of a conversion in isolation, on fixed inputs, and prints their median and 95th percentile over
+// repetitions, as a table or as json to compare runs across commits. It can also record the outputs of a run, and
+// its conversion times and peak RSS, and check later runs against them. Microbenchmarks compare the string hashes on
+// the legends and state paths of each workload.
+
+using namespace keylayout2kle;
+
+#ifndef SOURCE_DIR
+#define SOURCE_DIR "."
+#endif
+
+namespace
+{
+    struct Workload
+    {
+        std::string name;
+        std::string keylayout, kle, settings;
+    };
+
+    // Wall times of a stage in ms, one per repetition
+    struct StageTimes
+    {
+        std::string workload;
+        std::string stage;
+        std::vector<double> samples;
+    };
+
+    // Discards the output, and only counts its size
+    class NullBuf : public std::streambuf
+    {
+        public:
+            size_t size = 0;
+
+        protected:
+            int overflow(int c) override
+            {
+                size++;
+                return c;
+            }
+
+            std::streamsize xsputn(const char*, std::streamsize n) override
+            {
+                size += static_cast<size_t>(n);
+                return n;
+            }
+    };
+
+    // Time to hash each string of a set and to build a set of them, in ns per string, one per repetition. Collisions
+    // are the strings with the full hash of another one, bucket collisions the ones with its low bits, in a power of
+    // two table at least as large as the set.
+    struct HashTimes
+    {
+        std::string workload;
+        std::string set;
+        std::string function;
+        size_t numStrings = 0;
+        std::vector<double> hashSamples, setSamples;
+        size_t collisions = 0, bucketCollisions = 0;
+    };
+
+    struct WorkloadResult
+    {
+        std::vector<StageTimes> stages;
+        std::vector<HashTimes> hashes;
+        std::string output; // Of the warm-up conversion
+        size_t peakRss = 0; // KiB
+    };
+
+    // Starts measuring the peak RSS of the next workload. Without Linux's clear_refs the peak is the process one.
+    void resetPeakRss()
+    {
+#ifdef __linux__
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5";
+#endif
+    }
+
+    size_t workloadPeakRss()
+    {
+#ifdef __linux__
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while(std::getline(status, line))
+        {
+            if(!line.compare(0, 6, "VmHWM:")) return strtoul(line.c_str() + 6, nullptr, 10);
+        }
+#endif
+        return peakRss();
+    }
+
+    // Nearest rank percentile of sorted samples
+    double percentile(const std::vector<double> &sorted, double p)
+    {
+        size_t rank = static_cast<size_t>(std::ceil(p / 100. * sorted.size()));
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+
+    // Every key of every keyMap in every state of the settings. The checksum keeps the calls from being optimized out.
+    uint64_t lookupKeys(const CompiledLayout &layout, const std::vector<uint32_t> &stateIds)
+    {
+        uint64_t checksum = 0;
+        for(const CompiledKeyMapSet &keyMapSet : layout.keyMapSets)
+        {
+            for(uint32_t i = 0; i < keyMapSet.numKeyMaps; i++)
+            {
+                uint16_t mapIndex = static_cast<uint16_t>(layout.keyMaps[keyMapSet.firstKeyMap + i].index);
+                for(uint32_t state : stateIds) for(uint16_t keyCode = 0; keyCode < 128; keyCode++)
+                        checksum += layout.keyOutput(keyMapSet.id, state, mapIndex, keyCode).first;
+            }
+        }
+        return checksum;
+    }
+
+    // The shortest paths of every state, searched at increasing depths as the converter does
+    size_t searchStatePaths(const CompiledLayout &layout, const Settings &settings,
+            const std::vector<uint32_t> &stateIds)
+    {
+        uint32_t keyMapSetId = layout.strings.find(settings.keyMapSet.c_str());
+        size_t numPaths = 0;
+        for(uint32_t state : stateIds)
+        {
+            for(uint8_t depth = 0; depth < 5; depth++)
+            {
+                size_t found = layout.findStatePath(keyMapSetId, state, depth, settings.usedMapIndices).size();
+                numPaths += found;
+                if(found) break;
+            }
+        }
+        return numPaths;
+    }
+
+    // The legends of every layout key in every shown state of the settings, by place, as a page has them before
+    // merging. Dead keys give the legend of their state.
+    std::vector<std::vector<std::string>> keyLegends(const CompiledLayout &layout, const KleTemplate &kleTemplate,
+            const Settings &settings, const std::vector<uint32_t> &stateIds)
+    {
+        uint32_t keyMapSetId = layout.strings.find(settings.keyMapSet.c_str());
+        std::vector<std::vector<std::string>> ret;
+        for(size_t i = 0; i < stateIds.size(); i++) for(const std::vector<KleCell> &row : kleTemplate.rows)
+                for(const KleCell &cell : row)
+        {
+            if(!settings.states[i].show) continue;
+            if(cell.type != KleCell::LAYOUT_KEY) continue;
+            std::vector<std::string> legends(settings.numLegends);
+            for(const LegendSettings &legend : settings.legends)
+            {
+                if(legend.mergeType != LegendSettings::NO) continue;
+                std::pair<uint32_t, bool> output = layout.keyOutput(keyMapSetId, stateIds[i], legend.index,
+                        cell.keyCode);
+                if(output.first == StringArena::NONE) continue;
+                const char *str = layout.strings.str(output.first);
+                legends[legend.place] = output.second ? settings.stateLegend(str) : str;
+            }
+            // A label stops at its last legend
+            while(!legends.empty() && legends.back().empty()) legends.pop_back();
+            ret.push_back(std::move(legends));
+        }
+        return ret;
+    }
+
+    // The merge rules of the settings applied to each key
+    size_t mergeLegends(const Settings &settings, const std::vector<std::vector<std::string>> &keys)
+    {
+        const std::string empty;
+        size_t numMerged = 0;
+        for(const std::vector<std::string> &legends : keys) for(const LegendSettings &legend : settings.legends)
+        {
+            if(legend.mergeType == LegendSettings::NO) continue;
+            const std::string &legend0 = legend.merge[0] < legends.size() ? legends[legend.merge[0]] : empty;
+            const std::string &legend1 = legend.merge[1] < legends.size() ? legends[legend.merge[1]] : empty;
+            if(legend.merges(legend0, legend1)) numMerged++;
+        }
+        return numMerged;
+    }
+
+    // The labels of each key, with the legends of the decorated places
+    size_t decorateLegends(const Settings &settings, const std::vector<std::vector<std::string>> &keys)
+    {
+        LegendDecorator decorator(settings);
+        std::string label;
+        size_t size = 0;
+        for(const std::vector<std::string> &legends : keys)
+        {
+            label.clear();
+            for(size_t place = 0; place < legends.size(); place++)
+            {
+                if(settings.placesUsed[place]) decorator.decorate(legends[place], label);
+                else label += legends[place];
+                label += '\n';
+            }
+            size += label.size();
+        }
+        return size;
+    }
+
+    class Djb2Hasher
+    {
+        public:
+            size_t operator()(const std::string &str) const
+            {
+                return StrHash::make(str);
+            }
+    };
+
+    class StrHash64Hasher
+    {
+        public:
+            size_t operator()(const std::string &str) const
+            {
+                return static_cast<size_t>(StrHash64::make(str));
+            }
+    };
+
+    template<typename Hasher> HashTimes measureHash(const char *function, const std::vector<std::string> &strings,
+            unsigned repetitions)
+    {
+        HashTimes ret;
+        ret.function = function;
+        ret.numStrings = strings.size();
+        if(strings.empty()) return ret;
+        Hasher hasher;
+        std::unordered_set<size_t> hashes, buckets;
+        size_t mask = 1;
+        while(mask < strings.size()) mask <<= 1;
+        mask--;
+        for(const std::string &str : strings)
+        {
+            size_t hash = hasher(str);
+            hashes.insert(hash);
+            buckets.insert(hash & mask);
+        }
+        ret.collisions = strings.size() - hashes.size();
+        ret.bucketCollisions = strings.size() - buckets.size();
+
+        // Enough rounds for the clock resolution not to matter
+        size_t rounds = std::max<size_t>(1, 100000 / strings.size());
+        volatile size_t sink = 0;
+        for(unsigned repetition = 0; repetition <= repetitions; repetition++)
+        {
+            Clock::time_point start = Clock::now();
+            size_t sum = 0;
+            for(size_t round = 0; round < rounds; round++) for(const std::string &str : strings) sum += hasher(str);
+            double hashNs = msSince(start) * 1e6 / (rounds * strings.size());
+            sink = sink + sum;
+
+            start = Clock::now();
+            std::unordered_set<std::string, Hasher> set(strings.begin(), strings.end());
+            for(const std::string &str : strings) sum += set.count(str);
+            double setNs = msSince(start) * 1e6 / strings.size();
+            sink = sink + sum;
+            if(!repetition) continue;
+            ret.hashSamples.push_back(hashNs);
+            ret.setSamples.push_back(setNs);
+        }
+        return ret;
+    }
+
+    // The distinct strings of the layout, its legends, states and action ids, and the state paths of the settings,
+    // written as key legends with their modifier prefixes
+    std::vector<HashTimes> measureHashes(const std::string &workload, const CompiledLayout &layout,
+            const Settings &settings, const std::vector<uint32_t> &stateIds, unsigned repetitions)
+    {
+        std::vector<std::string> legends;
+        for(uint32_t id = 0; id < layout.strings.size(); id += static_cast<uint32_t>(legends.back().size()) + 1)
+                legends.push_back(layout.strings.str(id));
+        std::vector<std::string> paths;
+        uint32_t keyMapSetId = layout.strings.find(settings.keyMapSet.c_str());
+        for(uint32_t state : stateIds)
+        {
+            for(uint8_t depth = 0; depth < 5; depth++)
+            {
+                std::vector<std::vector<KeyWithLevel>> found = layout.findStatePath(keyMapSetId, state, depth,
+                        settings.usedMapIndices);
+                for(const std::vector<KeyWithLevel> &path : found)
+                {
+                    std::string str;
+                    for(const KeyWithLevel &key : path)
+                    {
+                        if(!str.empty()) str += " ";
+                        if(key.mapIndex < settings.modifiers.size()) str += settings.modifiers[key.mapIndex].prefix;
+                        const char *legend = layout.strings.str(layout.keyOutput(keyMapSetId, layout.noneState,
+                                key.mapIndex, key.keyCode).first);
+                        str += legend ? legend : std::to_string(key.keyCode);
+                    }
+                    paths.push_back(str);
+                }
+                if(!found.empty()) break;
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+        std::vector<HashTimes> ret;
+        for(int i = 0; i < 2; i++)
+        {
+            const std::vector<std::string> &strings = i ? paths : legends;
+            ret.push_back(measureHash<Djb2Hasher>("StrHash", strings, repetitions));
+            ret.push_back(measureHash<StrHash64Hasher>("StrHash64", strings, repetitions));
+            ret.push_back(measureHash<std::hash<std::string>>("std::hash", strings, repetitions));
+            for(size_t j = ret.size() - 3; j < ret.size(); j++)
+            {
+                ret[j].workload = workload;
+                ret[j].set = i ? "paths" : "legends";
+            }
+        }
+        return ret;
+    }
+
+    double phaseWall(const Profile &profile, const char *phase)
+    {
+        for(const Profile::Entry &entry : profile.phases()) if(entry.name == phase) return entry.time.wall;
+        return 0.;
+    }
+
+    WorkloadResult run(const Workload &workload, unsigned repetitions)
+    {
+        resetPeakRss();
+        std::string keylayout = Source::file(workload.keylayout).read();
+        Inputs inputs = loadInputs(Source::memory(keylayout), Source::file(workload.kle),
+                Source::file(workload.settings));
+        const CompiledLayout &layout = *inputs.layout;
+        const Settings &settings = *inputs.settings;
+        std::vector<uint32_t> stateIds;
+        for(const StateSettings &state : settings.states) stateIds.push_back(layout.strings.find(state.state.c_str()));
+        std::vector<std::vector<std::string>> keys = keyLegends(layout, *inputs.kleTemplate, settings, stateIds);
+
+        const char *stageNames[] = {"keylayout load", "key lookup", "state path search", "legend merge",
+                "ICU decoration", "page render", "conversion"};
+        const size_t numStages = sizeof(stageNames) / sizeof(stageNames[0]);
+        WorkloadResult ret;
+        ret.stages.resize(numStages);
+        for(size_t i = 0; i < numStages; i++)
+        {
+            ret.stages[i].workload = workload.name;
+            ret.stages[i].stage = stageNames[i];
+        }
+        volatile uint64_t sink = 0;
+        // The first repetition warms up the caches and ICU, and is not counted
+        for(unsigned repetition = 0; repetition <= repetitions; repetition++)
+        {
+            std::vector<double> times(numStages);
+            Clock::time_point start = Clock::now();
+            sink = sink + CompiledLayout::load(Source::memory(keylayout))->keys.size();
+            times[0] = msSince(start);
+
+            start = Clock::now();
+            sink = sink + lookupKeys(layout, stateIds);
+            times[1] = msSince(start);
+
+            start = Clock::now();
+            sink = sink + searchStatePaths(layout, settings, stateIds);
+            times[2] = msSince(start);
+
+            start = Clock::now();
+            sink = sink + mergeLegends(settings, keys);
+            times[3] = msSince(start);
+
+            start = Clock::now();
+            sink = sink + decorateLegends(settings, keys);
+            times[4] = msSince(start);
+
+            // The page render is only part of a conversion, the profile tells its share
+            Profile profile;
+            Options options;
+            options.profile = &profile;
+            options.warning = [](const std::string&) {};
+            Converter converter(inputs, options);
+            if(!repetition)
+            {
+                std::ostringstream out;
+                converter.convert(out);
+                ret.output = out.str();
+                continue;
+            }
+            NullBuf buf;
+            std::ostream out(&buf);
+            start = Clock::now();
+            converter.convert(out);
+            times[6] = msSince(start);
+            sink = sink + buf.size;
+            times[5] = phaseWall(profile, "pages");
+
+            for(size_t i = 0; i < numStages; i++) ret.stages[i].samples.push_back(times[i]);
+        }
+        ret.peakRss = workloadPeakRss();
+        ret.hashes = measureHashes(workload.name, layout, settings, stateIds, repetitions);
+        return ret;
+    }
+
+    double median(const StageTimes &stage)
+    {
+        std::vector<double> sorted = stage.samples;
+        std::sort(sorted.begin(), sorted.end());
+        return percentile(sorted, 50.);
+    }
+
+    std::string goldenPath(const std::string &dir, const Workload &workload)
+    {
+        return dir + "/" + workload.name + ".json";
+    }
+
+    // Writes the outputs of the workloads. They do not depend on the machine, bench/golden has the ones of the bundled
+    // workloads.
+    void recordOutputs(const std::string &dir, const std::vector<Workload> &workloads,
+            const std::vector<WorkloadResult> &results)
+    {
+        if(!makeDirectory(dir)) throw Error("Cannot create " + dir);
+        for(size_t i = 0; i < workloads.size(); i++)
+        {
+            std::ofstream golden(goldenPath(dir, workloads[i]), std::ios::binary);
+            golden << results[i].output;
+            if(!golden) throw Error("Cannot write " + goldenPath(dir, workloads[i]));
+        }
+    }
+
+    // Writes the median conversion time and the peak RSS of each workload, only comparable on the same machine
+    void recordBaseline(const std::string &file, const std::vector<Workload> &workloads,
+            const std::vector<WorkloadResult> &results)
+    {
+        nlohmann::json baseline = nlohmann::json::object();
+        for(size_t i = 0; i < workloads.size(); i++) baseline[workloads[i].name] = {
+                {"conversionMs", median(results[i].stages.back())}, {"peakRssKiB", results[i].peakRss}};
+        std::ofstream baselineFile(file);
+        baselineFile << baseline.dump(4) << std::endl;
+        if(!baselineFile) throw Error("Cannot write " + file);
+    }
+
+    // Compares the outputs byte for byte with the recorded ones. Returns false if any differs.
+    bool checkOutputs(const std::string &dir, const std::vector<Workload> &workloads,
+            const std::vector<WorkloadResult> &results, std::ostream &out)
+    {
+        bool ok = true;
+        for(size_t i = 0; i < workloads.size(); i++)
+        {
+            const std::string &output = results[i].output;
+            std::ifstream goldenFile(goldenPath(dir, workloads[i]), std::ios::binary);
+            if(!goldenFile)
+            {
+                out << "FAIL " << workloads[i].name << ": no golden output in " << dir << "\n";
+                ok = false;
+                continue;
+            }
+            std::string golden((std::istreambuf_iterator<char>(goldenFile)), std::istreambuf_iterator<char>());
+            if(golden == output) continue;
+            size_t diff = std::mismatch(golden.begin(), golden.begin() + std::min(golden.size(), output.size()),
+                    output.begin()).first - golden.begin();
+            out << "FAIL " << workloads[i].name << ": the output differs from the golden one at byte " << diff << "\n";
+            ok = false;
+        }
+        if(ok) out << "All " << workloads.size() << " outputs match " << dir << "\n";
+        out.flush();
+        return ok;
+    }
+
+    // Compares the median conversion times and the peak RSS with the baseline plus margin percent. Returns false if
+    // any exceeds it.
+    bool checkBaseline(const std::string &file, double margin, const std::vector<Workload> &workloads,
+            const std::vector<WorkloadResult> &results, std::ostream &out)
+    {
+        nlohmann::json baseline = nlohmann::json::parse(Source::file(file).read());
+        bool ok = true;
+        auto fail = [&](const std::string &workload, const std::string &message)
+        {
+            out << "SLOW " << workload << ": " << message << "\n";
+            ok = false;
+        };
+        for(size_t i = 0; i < workloads.size(); i++)
+        {
+            const std::string &name = workloads[i].name;
+            if(!baseline.contains(name))
+            {
+                fail(name, "not in the baseline");
+                continue;
+            }
+            double conversionMs = median(results[i].stages.back());
+            double baseMs = baseline.at(name).at("conversionMs").get<double>();
+            if(conversionMs > baseMs * (1. + margin / 100.)) fail(name, "the conversion takes "
+                    + std::to_string(conversionMs) + " ms, the baseline " + std::to_string(baseMs) + " ms");
+            size_t baseRss = baseline.at(name).at("peakRssKiB").get<size_t>();
+            if(results[i].peakRss > baseRss * (1. + margin / 100.)) fail(name, "the peak RSS is "
+                    + std::to_string(results[i].peakRss) + " KiB, the baseline " + std::to_string(baseRss) + " KiB");
+        }
+        if(ok) out << "All " << workloads.size() << " workloads are within " << margin << "% of " << file << "\n";
+        out.flush();
+        return ok;
+    }
+
+    nlohmann::json toJson(const std::vector<StageTimes> &results, const std::vector<HashTimes> &hashResults,
+            unsigned repetitions)
+    {
+        nlohmann::json stages = nlohmann::json::array();
+        for(const StageTimes &result : results)
+        {
+            std::vector<double> sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            stages.push_back({{"workload", result.workload}, {"stage", result.stage},
+                    {"medianMs", percentile(sorted, 50.)}, {"p95Ms", percentile(sorted, 95.)},
+                    {"minMs", sorted.front()}, {"maxMs", sorted.back()}});
+        }
+        nlohmann::json hashes = nlohmann::json::array();
+        for(const HashTimes &result : hashResults)
+        {
+            if(result.hashSamples.empty()) continue;
+            std::vector<double> hashSorted = result.hashSamples, setSorted = result.setSamples;
+            std::sort(hashSorted.begin(), hashSorted.end());
+            std::sort(setSorted.begin(), setSorted.end());
+            hashes.push_back({{"workload", result.workload}, {"set", result.set}, {"function", result.function},
+                    {"strings", result.numStrings}, {"hashMedianNs", percentile(hashSorted, 50.)},
+                    {"hashP95Ns", percentile(hashSorted, 95.)}, {"setMedianNs", percentile(setSorted, 50.)},
+                    {"setP95Ns", percentile(setSorted, 95.)}, {"collisions", result.collisions},
+                    {"bucketCollisions", result.bucketCollisions}});
+        }
+        return {{"repetitions", repetitions}, {"results", std::move(stages)}, {"hashes", std::move(hashes)}};
+    }
+
+    void print(std::ostream &out, const std::vector<StageTimes> &results, const std::vector<HashTimes> &hashResults,
+            unsigned repetitions)
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "%-12s %-28s %12s %12s %12s\n", "Workload", "Stage", "median (ms)", "p95 (ms)",
+                "min (ms)");
+        out << repetitions << " repetitions\n" << line;
+        for(const StageTimes &result : results)
+        {
+            std::vector<double> sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            snprintf(line, sizeof(line), "%-12.12s %-28.28s %12.3f %12.3f %12.3f\n", result.workload.c_str(),
+                    result.stage.c_str(), percentile(sorted, 50.), percentile(sorted, 95.), sorted.front());
+            out << line;
+        }
+        snprintf(line, sizeof(line), "\n%-12s %-8s %-10s %8s %12s %12s %11s %11s\n", "Workload", "Set", "Hash",
+                "strings", "hash (ns)", "set (ns)", "collisions", "in buckets");
+        out << line;
+        for(const HashTimes &result : hashResults)
+        {
+            if(result.hashSamples.empty()) continue;
+            std::vector<double> hashSorted = result.hashSamples, setSorted = result.setSamples;
+            std::sort(hashSorted.begin(), hashSorted.end());
+            std::sort(setSorted.begin(), setSorted.end());
+            snprintf(line, sizeof(line), "%-12.12s %-8s %-10s %8zu %12.2f %12.2f %11zu %11zu\n",
+                    result.workload.c_str(), result.set.c_str(), result.function.c_str(), result.numStrings,
+                    percentile(hashSorted, 50.), percentile(setSorted, 50.), result.collisions,
+                    result.bucketCollisions);
+            out << line;
+        }
+        out.flush();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        std::string sourceDir = SOURCE_DIR;
+        unsigned repetitions = 20;
+        bool json = false;
+        std::string recordDir, checkDir, recordBaselineFile, baselineFile;
+        double margin = 20.;
+        std::vector<Workload> workloads;
+        for(int i = 1; i < argc; i++)
+        {
+            if(!strcmp(argv[i], "--json")) json = true;
+            else if(!strcmp(argv[i], "--repetitions") && i + 1 < argc)
+            {
+                repetitions = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+                if(!repetitions) throw Error("The number of repetitions must be positive");
+            }
+            else if(!strcmp(argv[i], "--source-dir") && i + 1 < argc) sourceDir = argv[++i];
+            else if(!strcmp(argv[i], "--record") && i + 1 < argc) recordDir = argv[++i];
+            else if(!strcmp(argv[i], "--check") && i + 1 < argc) checkDir = argv[++i];
+            else if(!strcmp(argv[i], "--record-baseline") && i + 1 < argc) recordBaselineFile = argv[++i];
+            else if(!strcmp(argv[i], "--baseline") && i + 1 < argc) baselineFile = argv[++i];
+            else if(!strcmp(argv[i], "--margin") && i + 1 < argc)
+            {
+                char *end;
+                margin = strtod(argv[++i], &end);
+                if(*end || margin < 0.) throw Error(std::string("Invalid margin: ") + argv[i]);
+            }
+            else if(!strcmp(argv[i], "--workload") && i + 4 < argc)
+            {
+                workloads.push_back({argv[i + 1], argv[i + 2], argv[i + 3], argv[i + 4]});
+                i += 4;
+            }
+            else
+            {
+                std::cerr << "    Usage: " << argv[0] << " [options]\n"
+                        "\nOptions:\n\n"
+                        "    --repetitions <n>      timed repetitions of each stage, 20 by default\n"
+                        "    --json                 print the results as json\n"
+                        "    --source-dir <dir>     source tree with the examples and bench data\n"
+                        "    --record <dir>         write the outputs to dir\n"
+                        "    --check <dir>          exit with 1 if an output differs from the one in dir\n"
+                        "    --record-baseline <file>\n"
+                        "                           write the conversion times and peak RSS to file\n"
+                        "    --baseline <file>      exit with 2 if a conversion time or peak RSS exceeds the one\n"
+                        "                           in file by the margin, with 77 if file does not exist\n"
+                        "    --margin <percent>     20 by default\n"
+                        "    --workload <name> <keylayout> <kle json> <settings json>\n"
+                        "                           time these inputs instead of the bundled ones, can be repeated\n";
+                return -1;
+            }
+        }
+        // Nothing to compare the times with, CTest reports it as skipped
+        if(!baselineFile.empty() && !std::ifstream(baselineFile))
+        {
+            std::cerr << "No baseline " << baselineFile << ", record one with --record-baseline" << std::endl;
+            return 77;
+        }
+        if(workloads.empty())
+        {
+            workloads.push_back({"iso", sourceDir + "/bench/data/iso.keylayout", sourceDir + "/examples/iso.json",
+                    sourceDir + "/examples/settings.json"});
+            workloads.push_back({"states", sourceDir + "/bench/data/states.keylayout",
+                    sourceDir + "/examples/iso.json", sourceDir + "/bench/data/states.json"});
+        }
+
+        std::vector<WorkloadResult> workloadResults;
+        std::vector<StageTimes> results;
+        std::vector<HashTimes> hashResults;
+        for(const Workload &workload : workloads)
+        {
+            workloadResults.push_back(run(workload, repetitions));
+            const WorkloadResult &result = workloadResults.back();
+            results.insert(results.end(), result.stages.begin(), result.stages.end());
+            hashResults.insert(hashResults.end(), result.hashes.begin(), result.hashes.end());
+        }
+        if(json) std::cout << toJson(results, hashResults, repetitions).dump(4) << std::endl;
+        else print(std::cout, results, hashResults, repetitions);
+        if(!recordDir.empty()) recordOutputs(recordDir, workloads, workloadResults);
+        if(!recordBaselineFile.empty()) recordBaseline(recordBaselineFile, workloads, workloadResults);
+        // A wrong output is a failure whatever the times are
+        if(!checkDir.empty() && !checkOutputs(checkDir, workloads, workloadResults, std::cerr)) return 1;
+        if(!baselineFile.empty() && !checkBaseline(baselineFile, margin, workloads, workloadResults, std::cerr))
+                return 2;
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
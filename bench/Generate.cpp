@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "nlohmann/json.hpp"
+
+// Writes a synthetic keylayout of a chosen size and the settings json listing all its states, to measure how the
+// conversion scales. The same parameters and seed always give the same files.
+
+namespace
+{
+    struct Parameters
+    {
+        unsigned keyMapSets = 1;
+        unsigned keyMaps = 4; // Per keyMapSet
+        unsigned baseChain = 0; // keyMapSets after the first one based on the previous one
+        unsigned keys = 51; // Key codes 0 to keys - 1 in each keyMap
+        unsigned actions = 40;
+        unsigned states = 20; // Dead key states, besides none
+        unsigned depth = 2; // Of the dead key chains
+        unsigned branching = 4; // States reached from each state of a chain
+        unsigned whens = 8; // Random whens per action, besides the ones making the states reachable
+        double actionKeys = 0.5; // Fraction of keys with an action instead of an output
+        double nextFraction = 0.2; // Fraction of random whens with a next instead of an output
+        uint32_t seed = 1;
+        std::string output = "generated";
+    };
+
+    // xorshift32, the same sequence on every platform
+    class Random
+    {
+        public:
+            explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+
+            uint32_t next()
+            {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                return state;
+            }
+
+            uint32_t below(uint32_t n)
+            {
+                return next() % n;
+            }
+
+            bool chance(double p)
+            {
+                return next() < p * 4294967296.;
+            }
+
+        private:
+            uint32_t state;
+    };
+
+    std::string utf8(uint32_t c)
+    {
+        std::string ret;
+        if(c < 0x80) ret += static_cast<char>(c);
+        else if(c < 0x800)
+        {
+            ret += static_cast<char>(0xC0 | c >> 6);
+            ret += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            ret += static_cast<char>(0xE0 | c >> 12);
+            ret += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+            ret += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        return ret;
+    }
+
+    // Letters and CJK ideographs, none of them needs escaping in XML
+    std::string randomOutput(Random &random)
+    {
+        uint32_t n = random.below(26 + 2000);
+        return n < 26 ? utf8('a' + n) : utf8(0x4E00 + n - 26);
+    }
+
+    // Dead key states as trees: the roots are reached from none, each state of a chain leads to branching others
+    struct State
+    {
+        std::string name;
+        int parent; // -1 for none
+    };
+
+    std::vector<State> makeStates(const Parameters &p)
+    {
+        std::vector<State> states;
+        std::vector<unsigned> levels;
+        unsigned numRoots = p.depth > 1 ? std::max(1u, p.states / (p.branching + 1)) : p.states;
+        for(unsigned i = 0; i < numRoots && states.size() < p.states; i++)
+        {
+            states.push_back({"dk" + std::to_string(i), -1});
+            levels.push_back(1);
+        }
+        // Breadth first, so chains are as deep as the state count allows
+        for(size_t i = 0; i < states.size() && states.size() < p.states; i++)
+        {
+            if(levels[i] >= p.depth) continue;
+            for(unsigned b = 0; b < p.branching && states.size() < p.states; b++)
+            {
+                states.push_back({states[i].name + "_" + std::to_string(b), static_cast<int>(i)});
+                levels.push_back(levels[i] + 1);
+            }
+        }
+        return states;
+    }
+
+    void writeKeyMap(std::ostream &out, const Parameters &p, Random &random, unsigned &nextAction)
+    {
+        for(unsigned code = 0; code < p.keys; code++)
+        {
+            out << "<key code=\"" << code << "\" ";
+            if(p.actions && random.chance(p.actionKeys)) out << "action=\"a" << nextAction++ % p.actions << "\"/>\n";
+            else out << "output=\"" << randomOutput(random) << "\"/>\n";
+        }
+    }
+
+    // The modifierMap of the layout, with a keyMapSelect for each keyMap index. An index is selected by the modifiers
+    // of its bits, indices from 32 on repeat the combinations of the first ones.
+    void writeModifierMap(std::ostream &out, const Parameters &p)
+    {
+        static const char *modifiers[] = {"anyShift", "anyOption", "caps", "anyControl", "command"};
+        out << "<modifierMap id=\"m\" defaultIndex=\"0\">\n";
+        for(unsigned index = 0; index < p.keyMaps; index++)
+        {
+            out << "<keyMapSelect mapIndex=\"" << index << "\"><modifier keys=\"";
+            const char *separator = "";
+            for(unsigned bit = 0; bit < 5; bit++) if(index >> bit & 1)
+            {
+                out << separator << modifiers[bit];
+                separator = " ";
+            }
+            out << "\"/></keyMapSelect>\n";
+        }
+        out << "</modifierMap>\n";
+    }
+
+    void writeKeylayout(std::ostream &out, const Parameters &p, const std::vector<State> &states)
+    {
+        Random random(p.seed);
+        out << "<?xml version=\"1.1\" encoding=\"UTF-8\"?>\n"
+                "<!DOCTYPE keyboard SYSTEM \"file://localhost/System/Library/DTDs/KeyboardLayout.dtd\">\n"
+                "<keyboard group=\"126\" id=\"-1\" name=\"Generated\" maxout=\"3\">\n"
+                "<layouts><layout first=\"0\" last=\"0\" modifiers=\"m\" mapSet=\"set0\"/></layouts>\n";
+        writeModifierMap(out, p);
+        unsigned nextAction = 0;
+        for(unsigned set = 0; set < p.keyMapSets; set++)
+        {
+            out << "<keyMapSet id=\"set" << set << "\">\n";
+            bool based = set > 0 && set <= p.baseChain;
+            for(unsigned index = 0; index < p.keyMaps; index++)
+            {
+                out << "<keyMap index=\"" << index << "\"";
+                if(based)
+                {
+                    // A few keys of their own, the others from the previous map set
+                    out << " baseMapSet=\"set" << set - 1 << "\" baseIndex=\"" << index << "\">\n";
+                    for(unsigned code = 0; code < p.keys; code++) if(random.chance(0.1))
+                            out << "<key code=\"" << code << "\" output=\"" << randomOutput(random) << "\"/>\n";
+                }
+                else
+                {
+                    out << ">\n";
+                    writeKeyMap(out, p, random, nextAction);
+                }
+                out << "</keyMap>\n";
+            }
+            out << "</keyMapSet>\n";
+        }
+
+        // Each state is reached by a when, in its parent state, of one of the actions that keys have
+        std::vector<std::vector<std::string>> whens(p.actions);
+        std::vector<std::set<int>> whenStates(p.actions);
+        unsigned usedActions = std::min(p.actions, nextAction);
+        if(usedActions)
+        {
+            unsigned action = 0;
+            for(size_t i = 0; i < states.size(); i++)
+            {
+                unsigned tries = 0;
+                while(whenStates[action].count(states[i].parent) && tries++ < usedActions)
+                        action = (action + 1) % usedActions;
+                if(whenStates[action].count(states[i].parent)) continue; // Every action already leads from parent
+                whenStates[action].insert(states[i].parent);
+                whens[action].push_back("<when state=\""
+                        + (states[i].parent < 0 ? std::string("none") : states[states[i].parent].name)
+                        + "\" next=\"" + states[i].name + "\"/>");
+                action = (action + 1) % usedActions;
+            }
+        }
+        out << "<actions>\n";
+        for(unsigned action = 0; action < p.actions; action++)
+        {
+            out << "<action id=\"a" << action << "\">\n";
+            if(!whenStates[action].count(-1))
+                    out << "<when state=\"none\" output=\"" << randomOutput(random) << "\"/>\n";
+            for(const std::string &when : whens[action]) out << when << "\n";
+            for(unsigned i = 0; i < p.whens && !states.empty(); i++)
+            {
+                int state = static_cast<int>(random.below(static_cast<uint32_t>(states.size())));
+                if(!whenStates[action].insert(state).second) continue;
+                out << "<when state=\"" << states[state].name << "\" ";
+                if(random.chance(p.nextFraction))
+                        out << "next=\"" << states[random.below(static_cast<uint32_t>(states.size()))].name << "\"/>\n";
+                else out << "output=\"" << randomOutput(random) << "\"/>\n";
+            }
+            out << "</action>\n";
+        }
+        out << "</actions>\n<terminators>\n";
+        for(const State &state : states) out << "<when state=\"" << state.name << "\" output=\"^\"/>\n";
+        out << "</terminators>\n</keyboard>\n";
+    }
+
+    // The first based map set is rendered if there is one, so that lookups and path searches fall back to the first
+    // one. Path searches do not follow longer chains.
+    nlohmann::json makeSettings(const Parameters &p, const std::vector<State> &states)
+    {
+        nlohmann::json legends = nlohmann::json::array(), modifiers = nlohmann::json::array();
+        for(unsigned index = 0; index < p.keyMaps && index < 12; index++)
+        {
+            legends.push_back({{"place", index}, {"index", index}});
+            modifiers.push_back({{"index", index}, {"prefix", index ? "M" + std::to_string(index) + "-" : ""}});
+        }
+        nlohmann::json stateList = nlohmann::json::array();
+        stateList.push_back({{"state", "none"}, {"display", "Base"}, {"legend", "Base"}});
+        for(const State &state : states) stateList.push_back({{"state", state.name}});
+        unsigned keyMapSet = std::min(p.baseChain, std::min(p.keyMapSets - 1, 1u));
+        return {{"keyMapSet", "set" + std::to_string(keyMapSet)}, {"legends", legends}, {"modifiers", modifiers},
+                {"states", stateList}, {"stateDy", 1}, {"index", {{"width", 7.5}, {"numColumns", 3}}}};
+    }
+
+    bool parseUnsigned(const char *value, unsigned &ret)
+    {
+        char *end;
+        long long n = strtoll(value, &end, 10);
+        if(*end || n < 0 || n > 1000000) return false;
+        ret = static_cast<unsigned>(n);
+        return true;
+    }
+
+    bool parseFraction(const char *value, double &ret)
+    {
+        char *end;
+        ret = strtod(value, &end);
+        return !*end && ret >= 0. && ret <= 1.;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Parameters p;
+    bool valid = true;
+    for(int i = 1; i < argc && valid; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        unsigned seed = 0;
+        if(!value) valid = false;
+        else if(!strcmp(argv[i], "--keymapsets")) valid = parseUnsigned(value, p.keyMapSets) && p.keyMapSets;
+        else if(!strcmp(argv[i], "--keymaps")) valid = parseUnsigned(value, p.keyMaps) && p.keyMaps;
+        else if(!strcmp(argv[i], "--base-chain")) valid = parseUnsigned(value, p.baseChain);
+        else if(!strcmp(argv[i], "--keys")) valid = parseUnsigned(value, p.keys) && p.keys <= 128;
+        else if(!strcmp(argv[i], "--actions")) valid = parseUnsigned(value, p.actions);
+        else if(!strcmp(argv[i], "--states")) valid = parseUnsigned(value, p.states);
+        else if(!strcmp(argv[i], "--depth")) valid = parseUnsigned(value, p.depth) && p.depth;
+        else if(!strcmp(argv[i], "--branching")) valid = parseUnsigned(value, p.branching);
+        else if(!strcmp(argv[i], "--whens")) valid = parseUnsigned(value, p.whens);
+        else if(!strcmp(argv[i], "--action-keys")) valid = parseFraction(value, p.actionKeys);
+        else if(!strcmp(argv[i], "--next-fraction")) valid = parseFraction(value, p.nextFraction);
+        else if(!strcmp(argv[i], "--seed"))
+        {
+            valid = parseUnsigned(value, seed);
+            p.seed = seed;
+        }
+        else if(!strcmp(argv[i], "--output")) p.output = value;
+        else valid = false;
+        i++;
+    }
+    if(!valid)
+    {
+        std::cerr << "    Usage: " << argv[0] << " [options]\n"
+                "\nWrites <output>.keylayout and <output>.json, the settings listing all its states.\n"
+                "\nOptions:\n\n"
+                "    --output <prefix>      generated by default\n"
+                "    --keymapsets <n>       1 by default\n"
+                "    --keymaps <n>          keyMaps per keyMapSet, 4 by default\n"
+                "    --base-chain <n>       keyMapSets based on the previous one, 0 by default\n"
+                "    --keys <n>             keys per keyMap, at most 128, 51 by default\n"
+                "    --actions <n>          40 by default\n"
+                "    --states <n>           dead key states, 20 by default\n"
+                "    --depth <n>            length of the dead key chains, 2 by default\n"
+                "    --branching <n>        states reached from each state of a chain, 4 by default\n"
+                "    --whens <n>            random whens per action, 8 by default\n"
+                "    --action-keys <f>      fraction of keys with an action, 0.5 by default\n"
+                "    --next-fraction <f>    fraction of random whens with a next, 0.2 by default\n"
+                "    --seed <n>             1 by default\n";
+        return -1;
+    }
+
+    std::vector<State> states = makeStates(p);
+    std::ofstream keylayout(p.output + ".keylayout", std::ios::binary);
+    writeKeylayout(keylayout, p, states);
+    std::ofstream settings(p.output + ".json", std::ios::binary);
+    settings << makeSettings(p, states).dump(4) << std::endl;
+    keylayout.close();
+    settings.close();
+    if(!keylayout || !settings)
+    {
+        std::cerr << "Cannot write " << p.output << ".keylayout and " << p.output << ".json" << std::endl;
+        return -1;
+    }
+    return 0;
+}
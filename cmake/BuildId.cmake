@@ -0,0 +1,11 @@
+# Writes OUTPUT, a header defining KEYLAYOUT2KLE_BUILD_ID as the hash of the library sources in SOURCE_DIR.
+# Run by the build each time a source changes, the result cache keys depend on it.
+FILE(GLOB_RECURSE sources RELATIVE ${SOURCE_DIR} ${SOURCE_DIR}/src/lib/* ${SOURCE_DIR}/include/*)
+LIST(SORT sources)
+SET(hashes "")
+FOREACH(source ${sources})
+    FILE(SHA256 ${SOURCE_DIR}/${source} hash)
+    SET(hashes "${hashes}${source} ${hash}\n")
+ENDFOREACH(source)
+STRING(SHA256 buildId "${hashes}")
+FILE(WRITE ${OUTPUT} "#pragma once\n\n// Generated by cmake/BuildId.cmake\n#define KEYLAYOUT2KLE_BUILD_ID \"${buildId}\"\n")
@@ -0,0 +1,144 @@
+# Checks that the options said to keep the output byte for byte, or to reuse parts of it, give the same output as a
+# plain run, and that the output of --dedupe-pages is the recorded one.
+# Run by CTest with CHECK, CONVERT, SOURCE_DIR and WORK_DIR set, and GZIP for the gzip test. After an intended output
+# change, update the EXPECTED_ hashes.
+SET(EXPECTED_DEDUPE_SHA256 8d9937384e826b7e7015aae3d1bbbd4d3c461cc4cfeb9daf483b862293f978d9)
+SET(KEYLAYOUT ${SOURCE_DIR}/bench/data/iso.keylayout)
+SET(KLE ${SOURCE_DIR}/examples/iso.json)
+SET(SETTINGS ${SOURCE_DIR}/examples/settings.json)
+SET(prefix ${WORK_DIR}/${CHECK})
+FILE(REMOVE_RECURSE ${prefix})
+FILE(MAKE_DIRECTORY ${prefix})
+
+# Converts the inputs with the options that follow output, to output or to the standard output if it is "-"
+FUNCTION(CONVERT_TO output)
+    IF(output STREQUAL "-")
+        EXECUTE_PROCESS(COMMAND ${CONVERT} ${ARGN} RESULT_VARIABLE result ERROR_VARIABLE errors)
+    ELSE(output STREQUAL "-")
+        EXECUTE_PROCESS(COMMAND ${CONVERT} ${ARGN} --output ${output} RESULT_VARIABLE result ERROR_VARIABLE errors)
+    ENDIF(output STREQUAL "-")
+    IF(NOT result EQUAL 0)
+        MESSAGE(FATAL_ERROR "keylayout2kle ${ARGN} failed: ${result} ${errors}")
+    ENDIF(NOT result EQUAL 0)
+ENDFUNCTION(CONVERT_TO)
+
+FUNCTION(EXPECT_SAME expected actual)
+    EXECUTE_PROCESS(COMMAND ${CMAKE_COMMAND} -E compare_files ${expected} ${actual} RESULT_VARIABLE result)
+    IF(NOT result EQUAL 0)
+        MESSAGE(FATAL_ERROR "${actual} differs from ${expected}")
+    ENDIF(NOT result EQUAL 0)
+ENDFUNCTION(EXPECT_SAME)
+
+FUNCTION(EXPECT_HASH file expected)
+    FILE(SHA256 ${file} hash)
+    IF(NOT hash STREQUAL expected)
+        MESSAGE(FATAL_ERROR "${file} has the hash ${hash} instead of ${expected}")
+    ENDIF(NOT hash STREQUAL expected)
+ENDFUNCTION(EXPECT_HASH)
+
+CONVERT_TO(${prefix}/full.json ${KEYLAYOUT} ${KLE} ${SETTINGS})
+
+IF(CHECK STREQUAL "shard_merge")
+    # Round-robin and balanced shards, merged, give the full output
+    FOREACH(mode round-robin balanced)
+        SET(shards)
+        FOREACH(i 1 2 3)
+            CONVERT_TO(${prefix}/${mode}_${i}.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --shard ${i}/3
+                --shard-mode ${mode})
+            LIST(APPEND shards ${prefix}/${mode}_${i}.json)
+        ENDFOREACH(i)
+        EXECUTE_PROCESS(COMMAND ${CONVERT} --merge ${shards} OUTPUT_FILE ${prefix}/${mode}.json
+            RESULT_VARIABLE result ERROR_VARIABLE errors)
+        IF(NOT result EQUAL 0)
+            MESSAGE(FATAL_ERROR "The merge of the ${mode} shards failed: ${errors}")
+        ENDIF(NOT result EQUAL 0)
+        EXPECT_SAME(${prefix}/full.json ${prefix}/${mode}.json)
+    ENDFOREACH(mode)
+
+ELSEIF(CHECK STREQUAL "split_output")
+    # Each split page is the output of its page range alone, the index the one of --index-only
+    CONVERT_TO(- ${KEYLAYOUT} ${KLE} ${SETTINGS} --split-output ${prefix}/split)
+    FILE(GLOB pages RELATIVE ${prefix}/split ${prefix}/split/page_*.json)
+    LIST(LENGTH pages numPages)
+    IF(numPages LESS 2)
+        MESSAGE(FATAL_ERROR "--split-output wrote ${numPages} pages")
+    ENDIF(numPages LESS 2)
+    FOREACH(page ${pages})
+        STRING(REGEX REPLACE "page_0*([0-9]+)\\.json" "\\1" number ${page})
+        CONVERT_TO(${prefix}/${page} ${KEYLAYOUT} ${KLE} ${SETTINGS} --min-page ${number} --max-page ${number}
+            --no-index)
+        EXPECT_SAME(${prefix}/${page} ${prefix}/split/${page})
+    ENDFOREACH(page)
+    CONVERT_TO(${prefix}/index.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --index-only)
+    EXPECT_SAME(${prefix}/index.json ${prefix}/split/index.json)
+
+ELSEIF(CHECK STREQUAL "gzip")
+    CONVERT_TO(${prefix}/out.json.gz ${KEYLAYOUT} ${KLE} ${SETTINGS} --compress gzip)
+    EXECUTE_PROCESS(COMMAND ${GZIP} -dc ${prefix}/out.json.gz OUTPUT_FILE ${prefix}/out.json RESULT_VARIABLE result)
+    IF(NOT result EQUAL 0)
+        MESSAGE(FATAL_ERROR "${prefix}/out.json.gz is not valid gzip")
+    ENDIF(NOT result EQUAL 0)
+    EXPECT_SAME(${prefix}/full.json ${prefix}/out.json)
+
+ELSEIF(CHECK STREQUAL "incremental_cache")
+    # A rerun after a <when> edit reuses the unaffected pages and paths, and gives the output of a full run
+    CONVERT_TO(${prefix}/first.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --incremental-cache ${prefix}/cache)
+    EXPECT_SAME(${prefix}/full.json ${prefix}/first.json)
+    FILE(READ ${KEYLAYOUT} keylayout)
+    STRING(REPLACE "<when state=\"trema\" output=\"a\"/>" "<when state=\"trema\" output=\"z\"/>" edited
+        "${keylayout}")
+    IF(edited STREQUAL keylayout)
+        MESSAGE(FATAL_ERROR "The <when> to edit is not in ${KEYLAYOUT}")
+    ENDIF(edited STREQUAL keylayout)
+    FILE(WRITE ${prefix}/edited.keylayout "${edited}")
+    CONVERT_TO(${prefix}/edited.json ${prefix}/edited.keylayout ${KLE} ${SETTINGS})
+    CONVERT_TO(${prefix}/second.json ${prefix}/edited.keylayout ${KLE} ${SETTINGS}
+        --incremental-cache ${prefix}/cache)
+    EXPECT_SAME(${prefix}/edited.json ${prefix}/second.json)
+    EXECUTE_PROCESS(COMMAND ${CMAKE_COMMAND} -E compare_files ${prefix}/full.json ${prefix}/edited.json
+        RESULT_VARIABLE result)
+    IF(result EQUAL 0)
+        MESSAGE(FATAL_ERROR "The <when> edit did not change the output")
+    ENDIF(result EQUAL 0)
+
+ELSEIF(CHECK STREQUAL "cache_dir")
+    # A hit gives the output of the miss, and other options miss
+    CONVERT_TO(${prefix}/miss.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --cache-dir ${prefix}/cache)
+    CONVERT_TO(${prefix}/hit.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --cache-dir ${prefix}/cache)
+    EXPECT_SAME(${prefix}/full.json ${prefix}/miss.json)
+    EXPECT_SAME(${prefix}/full.json ${prefix}/hit.json)
+    CONVERT_TO(${prefix}/pages.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --max-page 2)
+    CONVERT_TO(${prefix}/pagesCached.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --max-page 2 --cache-dir ${prefix}/cache)
+    EXPECT_SAME(${prefix}/pages.json ${prefix}/pagesCached.json)
+
+ELSEIF(CHECK STREQUAL "dedupe_pages")
+    # Shards number the deduplicated pages as a single run does
+    CONVERT_TO(${prefix}/dedupe.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --dedupe-pages)
+    EXPECT_HASH(${prefix}/dedupe.json ${EXPECTED_DEDUPE_SHA256})
+    SET(shards)
+    FOREACH(i 1 2)
+        CONVERT_TO(${prefix}/shard_${i}.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --dedupe-pages --shard ${i}/2)
+        LIST(APPEND shards ${prefix}/shard_${i}.json)
+    ENDFOREACH(i)
+    EXECUTE_PROCESS(COMMAND ${CONVERT} --merge ${shards} OUTPUT_FILE ${prefix}/merged.json RESULT_VARIABLE result)
+    IF(NOT result EQUAL 0)
+        MESSAGE(FATAL_ERROR "The merge of the --dedupe-pages shards failed")
+    ENDIF(NOT result EQUAL 0)
+    EXPECT_SAME(${prefix}/dedupe.json ${prefix}/merged.json)
+
+ELSEIF(CHECK STREQUAL "keymapsets")
+    # Settings with several keyMapSets give the output of a run on each one
+    FILE(READ ${SETTINGS} settings)
+    STRING(REPLACE "\"keyMapSet\":\"ISO\"" "\"keyMapSet\":[\"ISO\", \"ANSI\"]" several "${settings}")
+    IF(several STREQUAL settings)
+        MESSAGE(FATAL_ERROR "The keyMapSet to replace is not in ${SETTINGS}")
+    ENDIF(several STREQUAL settings)
+    FILE(WRITE ${prefix}/settings.json "${several}")
+    CONVERT_TO(${prefix}/out.json ${KEYLAYOUT} ${KLE} ${prefix}/settings.json)
+    EXPECT_SAME(${prefix}/full.json ${prefix}/out.ISO.json)
+    CONVERT_TO(${prefix}/ansi.json ${KEYLAYOUT} ${KLE} ${SETTINGS} --keymapset ANSI)
+    EXPECT_SAME(${prefix}/ansi.json ${prefix}/out.ANSI.json)
+
+ELSE(CHECK STREQUAL "shard_merge")
+    MESSAGE(FATAL_ERROR "Unknown check ${CHECK}")
+ENDIF(CHECK STREQUAL "shard_merge")
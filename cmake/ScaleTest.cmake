@@ -0,0 +1,27 @@
+# Converts a generated keylayout with 1100 dead key states, more than the former 8-bit limits allowed, and about
+# 100000 whens. The compiled lookups must match the XML reference and the output must be the recorded one.
+# Run by CTest with GENERATE, CONVERT, KLE and WORK_DIR set. After an intended output change, update EXPECTED_SHA256.
+SET(EXPECTED_SHA256 428bff291edf51d368d0ae66f6f88b6d18c9b47c26a4381a28abbcb728c62941)
+SET(prefix ${WORK_DIR}/scale)
+
+EXECUTE_PROCESS(COMMAND ${GENERATE} --states 1100 --depth 3 --branching 6 --actions 2000 --whens 50
+    --output ${prefix} RESULT_VARIABLE result)
+IF(NOT result EQUAL 0)
+    MESSAGE(FATAL_ERROR "keylayout2kle_generate failed: ${result}")
+ENDIF(NOT result EQUAL 0)
+
+EXECUTE_PROCESS(COMMAND ${CONVERT} ${prefix}.keylayout ${KLE} ${prefix}.json --verify-engine
+    RESULT_VARIABLE result ERROR_VARIABLE errors)
+IF(NOT result EQUAL 0)
+    MESSAGE(FATAL_ERROR "The compiled lookups do not match the reference: ${errors}")
+ENDIF(NOT result EQUAL 0)
+
+EXECUTE_PROCESS(COMMAND ${CONVERT} ${prefix}.keylayout ${KLE} ${prefix}.json --output ${prefix}.out.json
+    RESULT_VARIABLE result ERROR_VARIABLE errors)
+IF(NOT result EQUAL 0)
+    MESSAGE(FATAL_ERROR "The conversion failed: ${errors}")
+ENDIF(NOT result EQUAL 0)
+FILE(SHA256 ${prefix}.out.json hash)
+IF(NOT hash STREQUAL EXPECTED_SHA256)
+    MESSAGE(FATAL_ERROR "The output ${prefix}.out.json has the hash ${hash} instead of ${EXPECTED_SHA256}")
+ENDIF(NOT hash STREQUAL EXPECTED_SHA256)
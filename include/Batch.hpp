@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+/// \file Batch.hpp
+/// \brief Batch mode.
+
+namespace keylayout2kle
+{
+
+/// \brief Runs the jobs of a manifest on a pool of threads, then prints a timing summary to stderr.
+/// The manifest is {"jobs": [job...]} or an array of jobs (see Job.hpp). Each job needs an output file or a split
+/// directory. Relative paths are relative to the manifest. Each distinct input is loaded once and shared by the jobs.
+/// \param numThreads : 0 for the number of hardware threads.
+/// \return true if all the jobs succeeded.
+/// \throw Error if the manifest cannot be read.
+bool runBatch(const std::string &manifestPath, unsigned numThreads = 0);
+
+}
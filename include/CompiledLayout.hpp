@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+#include "StrHash.hpp"
+#include "Util.hpp"
+
+namespace tinyxml2
+{
+    class XMLNode;
+}
+
+namespace keylayout2kle
+{
+
+// Strings extracted from the keylayout, each one stored once in a single buffer. A string id is its offset in the
+// buffer, so two ids are equal if and only if their strings are equal.
+class StringArena
+{
+    public:
+        static const uint32_t NONE = UINT32_MAX; // Absent attribute
+        static const uint32_t UNKNOWN = UINT32_MAX - 1; // A string that is not in the arena
+
+        uint32_t intern(const char *str)
+        {
+            uint32_t id = find(str);
+            if(id != UNKNOWN) return id;
+            id = static_cast<uint32_t>(data.size());
+            data.append(str, strlen(str) + 1);
+            lookup.emplace(StrHash::make(str), id);
+            return id;
+        }
+
+        uint32_t find(const char *str) const
+        {
+            if(!str) return NONE;
+            auto range = lookup.equal_range(StrHash::make(str));
+            for(auto it = range.first; it != range.second; ++it) if(!strcmp(data.c_str() + it->second, str))
+                    return it->second;
+            return UNKNOWN;
+        }
+
+        const char *str(uint32_t id) const
+        {
+            return id < data.size() ? data.c_str() + id : nullptr;
+        }
+
+        size_t size() const
+        {
+            return data.size();
+        }
+
+        void shrink()
+        {
+            data.shrink_to_fit();
+        }
+
+    private:
+        std::string data;
+        std::unordered_multimap<StrHash, uint32_t, StrHashIdentity> lookup;
+};
+
+// The keylayout's keyMapSets and actions, extracted from the XML document so it can be released. Elements keep the
+// document order, keys and whens are stored contiguously and referenced by ranges.
+struct CompiledKey
+{
+    int code;
+    uint32_t output;
+    uint32_t action;
+    uint32_t actionIndex; // First action with that id, NONE if there is none
+};
+
+struct CompiledKeyMap
+{
+    int index;
+    uint32_t baseMapSet;
+    int baseIndex;
+    uint32_t firstKey, numKeys;
+};
+
+struct CompiledKeyMapSet
+{
+    uint32_t id;
+    uint32_t firstKeyMap, numKeyMaps;
+};
+
+struct CompiledWhen
+{
+    uint32_t state;
+    uint32_t output;
+    uint32_t next;
+};
+
+struct CompiledAction
+{
+    uint32_t id;
+    uint32_t nextSameId; // Next action with the same id, NONE if there is none
+    uint32_t firstWhen, numWhens;
+};
+
+// Packed in 4 bytes, paths are small vectors of them
+struct KeyWithLevel
+{
+    uint16_t mapIndex;
+    uint16_t keyCode;
+};
+
+class CompiledLayout
+{
+    public:
+        StringArena strings;
+        std::vector<CompiledKeyMapSet> keyMapSets;
+        std::vector<CompiledKeyMap> keyMaps;
+        std::vector<CompiledKey> keys;
+        std::vector<CompiledAction> actions;
+        std::vector<CompiledWhen> whens;
+        uint32_t noneState;
+        size_t numXmlElements = 0; // Visited by the compilation, the document is not read afterwards
+
+        /// \brief Parses and compiles a keylayout. The XML document is released before returning.
+        /// \param source : the keylayout file or content.
+        /// \param loadTime, compileTime : if not null, set to the XML parsing and compilation times.
+        static std::shared_ptr<const CompiledLayout> load(const Source &source, Timing *loadTime = nullptr,
+                Timing *compileTime = nullptr);
+
+        explicit CompiledLayout(const tinyxml2::XMLNode *keyboardNode);
+
+        // Legend, isDead
+        std::pair<uint32_t, bool> keyOutput(uint32_t mapName, uint32_t stateName, uint16_t mapIndex,
+                uint16_t keyCode) const;
+
+        uint32_t actionState(uint32_t actionIndex) const;
+
+        // Outer: multiple paths, inner: a path with multiple keys. Only keyMaps whose index is in usedMapIndices are
+        // searched.
+        std::vector<std::vector<KeyWithLevel>> findStatePath(uint32_t mapName, uint32_t stateName, uint8_t depth,
+                const std::vector<bool> &usedMapIndices,
+                const std::unordered_set<uint32_t> &forbiddenStates = std::unordered_set<uint32_t>()) const;
+
+        // Hash of everything state paths are searched in: keyMaps, key actions and action whens. Key outputs are
+        // left out.
+        uint64_t transitionHash() const;
+
+        size_t memoryUsage() const
+        {
+            return strings.size() + keyMapSets.capacity() * sizeof(CompiledKeyMapSet)
+                    + keyMaps.capacity() * sizeof(CompiledKeyMap) + keys.capacity() * sizeof(CompiledKey)
+                    + actions.capacity() * sizeof(CompiledAction) + whens.capacity() * sizeof(CompiledWhen);
+        }
+};
+
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <streambuf>
+#include <vector>
+#include <stdint.h>
+#include "Compression.hpp"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/// \file CompressedStreamBuf.hpp
+/// \brief Definition for CompressedStreamBuf use.
+
+/// \class CompressedStreamBuf
+/// \brief Stream buffer that compresses everything written to it into another stream buffer.
+/// Data is compressed as it comes, only a fixed size buffer is kept in memory.
+/// It is only included by the library sources, its members depend on HAVE_ZLIB and HAVE_ZSTD.
+class CompressedStreamBuf : public std::streambuf, public Compression
+{
+    public:
+        /// \brief Tells if a format is available in this build.
+        /// \param format : the compression format.
+        /// \return true if data can be compressed in that format.
+        static bool isSupported(Format format)
+        {
+            switch(format)
+            {
+#ifdef HAVE_ZLIB
+                case GZIP: return true;
+#endif
+#ifdef HAVE_ZSTD
+                case ZSTD: return true;
+#endif
+                default: return false;
+            }
+        }
+
+        /// \brief File name extension of a format.
+        /// \param format : the compression format.
+        /// \return the extension, with its leading dot.
+        static const char *extension(Format format)
+        {
+            return format == GZIP ? ".gz" : ".zst";
+        }
+
+        /// \brief Starts a compressed stream.
+        /// \param sink : where the compressed data is written.
+        /// \param format : the compression format. It must be supported.
+        CompressedStreamBuf(std::streambuf *sink, Format format) : sink(sink), format(format), in(BUFFER_SIZE),
+                out(BUFFER_SIZE)
+        {
+            setp(in.data(), in.data() + in.size());
+            switch(format)
+            {
+#ifdef HAVE_ZLIB
+                case GZIP:
+                    // 16 + MAX_WBITS: gzip header and trailer instead of zlib ones
+                    deflateInit2(&zStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+                    break;
+#endif
+#ifdef HAVE_ZSTD
+                case ZSTD:
+                    zstdStream = ZSTD_createCStream();
+                    ZSTD_initCStream(zstdStream, ZSTD_CLEVEL_DEFAULT);
+                    break;
+#endif
+                default:
+                    ok = false;
+                    break;
+            }
+        }
+
+        ~CompressedStreamBuf()
+        {
+            finish();
+        }
+
+        CompressedStreamBuf(const CompressedStreamBuf&) = delete;
+        CompressedStreamBuf &operator=(const CompressedStreamBuf&) = delete;
+
+        /// \brief Compresses the remaining data and ends the compressed stream.
+        /// Nothing can be written after this.
+        /// \return true if all the data has been compressed and written.
+        bool finish()
+        {
+            if(finished) return ok;
+            compress(true);
+            finished = true;
+            sink->pubsync();
+#ifdef HAVE_ZLIB
+            if(format == GZIP) deflateEnd(&zStream);
+#endif
+#ifdef HAVE_ZSTD
+            if(format == ZSTD) ZSTD_freeCStream(zstdStream);
+#endif
+            return ok;
+        }
+
+    protected:
+        int_type overflow(int_type c) override
+        {
+            if(finished || !compress(false)) return traits_type::eof();
+            if(!traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        int sync() override
+        {
+            // Do not flush the compressor, it would degrade the compression ratio
+            if(finished || !compress(false)) return -1;
+            return sink->pubsync();
+        }
+
+    private:
+        static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+        std::streambuf *sink;
+        Format format;
+        bool ok = true;
+        bool finished = false;
+        std::vector<char> in, out;
+#ifdef HAVE_ZLIB
+        z_stream zStream = z_stream();
+#endif
+#ifdef HAVE_ZSTD
+        ZSTD_CStream *zstdStream = nullptr;
+#endif
+
+        /// \brief Compresses the buffered data and writes the output to the sink.
+        /// \param end : true to end the compressed stream.
+        /// \return false on error.
+        bool compress(bool end)
+        {
+            size_t size = pptr() - pbase();
+            setp(in.data(), in.data() + in.size());
+            if(!ok) return false;
+            if(!size && !end) return true;
+            switch(format)
+            {
+#ifdef HAVE_ZLIB
+                case GZIP:
+                {
+                    zStream.next_in = reinterpret_cast<Bytef*>(in.data());
+                    zStream.avail_in = static_cast<uInt>(size);
+                    int ret;
+                    do
+                    {
+                        zStream.next_out = reinterpret_cast<Bytef*>(out.data());
+                        zStream.avail_out = static_cast<uInt>(out.size());
+                        ret = deflate(&zStream, end ? Z_FINISH : Z_NO_FLUSH);
+                        if(ret == Z_STREAM_ERROR || !write(out.size() - zStream.avail_out)) return ok = false;
+                    } while(zStream.avail_out == 0 || (end && ret != Z_STREAM_END));
+                    break;
+                }
+#endif
+#ifdef HAVE_ZSTD
+                case ZSTD:
+                {
+                    ZSTD_inBuffer input = {in.data(), size, 0};
+                    size_t remaining;
+                    do
+                    {
+                        ZSTD_outBuffer output = {out.data(), out.size(), 0};
+                        remaining = ZSTD_compressStream2(zstdStream, &output, &input,
+                                end ? ZSTD_e_end : ZSTD_e_continue);
+                        if(ZSTD_isError(remaining) || !write(output.pos)) return ok = false;
+                    } while(end ? remaining != 0 : input.pos < input.size);
+                    break;
+                }
+#endif
+                default:
+                    return ok = false;
+            }
+            return true;
+        }
+
+        /// \brief Writes compressed data to the sink.
+        /// \param size : number of bytes at the beginning of the output buffer.
+        /// \return false on error.
+        bool write(size_t size)
+        {
+            return sink->sputn(out.data(), static_cast<std::streamsize>(size)) == static_cast<std::streamsize>(size);
+        }
+};
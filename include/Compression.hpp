@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+/// \file Compression.hpp
+/// \brief Definition for Compression use.
+
+/// \struct Compression
+/// \brief Output compression formats. They are kept apart from CompressedStreamBuf, whose layout depends on the
+/// libraries found when building, so that the public headers do not depend on them.
+struct Compression
+{
+    /// Compression formats.
+    enum Format : uint8_t {GZIP, ZSTD};
+};
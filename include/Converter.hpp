@@ -0,0 +1,244 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+#include <unicode/umachine.h>
+#include "CompiledLayout.hpp"
+#include "Compression.hpp"
+#include "Counters.hpp"
+#include "KleTemplate.hpp"
+#include "Profile.hpp"
+#include "Trace.hpp"
+#include "Settings.hpp"
+#include "Util.hpp"
+
+/// \file Converter.hpp
+/// \brief Entry point of the keylayout2kle library.
+
+namespace keylayout2kle
+{
+
+/// \brief Time spent loading each input.
+struct LoadTimings
+{
+    Timing keylayoutLoad;
+    Timing keylayoutCompile;
+    Timing kleParse;
+    Timing kleTemplate;
+    Timing settingsParse;
+    Timing settingsInterpret;
+};
+
+/// \brief The three inputs of a conversion, loaded and compiled. They are immutable and can be shared by several
+/// converters.
+struct Inputs
+{
+    std::shared_ptr<const CompiledLayout> layout;
+    std::shared_ptr<const KleTemplate> kleTemplate;
+    std::shared_ptr<const Settings> settings;
+    LoadTimings timings;
+    size_t loadedRss = 0; ///< RSS in KiB when the keylayout was compiled, before its document was released.
+};
+
+/// \brief Loads the inputs concurrently: the keylayout and the KLE keyboard on their own threads, the settings on the
+/// calling one.
+/// \param trace : if not null, receives a span for each input.
+/// \throw Error if an input cannot be read or is invalid.
+Inputs loadInputs(const Source &keylayout, const Source &kle, const Source &settings, Trace *trace = nullptr);
+
+/// \brief What to render and how to write it.
+struct Options
+{
+    enum ShardMode : uint8_t {ROUND_ROBIN, BALANCED};
+    enum IndexMode : uint8_t {WITH_INDEX, NO_INDEX, INDEX_ONLY};
+
+    static const uint32_t LAST_PAGE = UINT32_MAX - 1;
+
+    uint32_t minPage = 0, maxPage = LAST_PAGE;
+    uint32_t shardIndex = 0, numShards = 0; ///< 1-based shard index, no sharding if numShards is 0.
+    ShardMode shardMode = ROUND_ROBIN;
+    std::string splitDir; ///< If not empty, write one file per page and a manifest in this directory.
+    bool splitIndex = false;
+    std::string keyMapSet; ///< Rendered instead of the settings' first one if not empty.
+    IndexMode indexMode = WITH_INDEX; ///< INDEX_ONLY renders the index and no page, even if minPage is not 0.
+    /// Render states with identical keys once. The index gives the page of the first state to all of them.
+    bool dedupePages = false;
+    bool stats = false; ///< Count the hot path operations, see Converter::stats.
+    std::string incrementalCache; ///< If not empty, pages and paths of the previous run are reused from this file.
+    bool compress = false;
+    Compression::Format compressFormat = Compression::GZIP;
+    Profile *profile = nullptr; ///< Receives the time of each phase and page if not null.
+    Trace *trace = nullptr; ///< Receives the spans of the conversion if not null.
+    /// Receives the warnings. They are written to std::cerr if it is empty.
+    std::function<void(const std::string&)> warning;
+
+    /// \brief Tells if an option is known and takes a value.
+    /// \param name : the option name, as on the command line without the leading "--".
+    static bool takesValue(const std::string &name);
+
+    /// \brief Sets an option from its command line form.
+    /// \param name : the option name, without the leading "--".
+    /// \param value : the option value, ignored by flags.
+    /// \throw Error if the option is unknown or the value is invalid.
+    void set(const std::string &name, const std::string &value = std::string());
+
+    /// \brief Checks that the options can be used together.
+    /// \throw Error otherwise.
+    void validate() const;
+
+    void warn(const std::string &message) const;
+
+    /// \brief Canonical description of the options that change the output, for cache keys.
+    std::string describe() const;
+};
+
+/// \brief Renders the pages of a keyboard. A converter holds no global state, several ones can run concurrently.
+class Converter
+{
+    public:
+        /// \throw Error if the options are invalid.
+        Converter(Inputs inputs, Options options = Options());
+
+        /// \brief Writes the output. In split mode the files are written in the split directory and nothing is
+        /// written to out.
+        /// \throw Error if the output cannot be written.
+        void convert(std::ostream &out);
+
+        /// \brief Takes the state paths already computed by another converter, if it has the same keylayout, settings
+        /// and rendered keyMapSet. Paths do not depend on the KLE keyboard nor on the other options.
+        void reuseStatePaths(const Converter &previous);
+
+        const Inputs &inputs() const
+        {
+            return in;
+        }
+
+        const Options &options() const
+        {
+            return opts;
+        }
+
+        /// \brief Pages taken from the incremental cache and pages rendered by the last conversion.
+        size_t reusedPages() const
+        {
+            return numReusedPages;
+        }
+
+        size_t renderedPages() const
+        {
+            return numRenderedPages;
+        }
+
+        /// \brief Operations counted by the last conversion, with the stats option.
+        Counters stats() const
+        {
+            std::lock_guard<std::mutex> lock(countersMutex);
+            return counters;
+        }
+
+    private:
+        // A keyOutput call of a page or a state path, with its result. The keyMapSet is always the used one.
+        struct KeyQuery
+        {
+            uint32_t state;
+            uint16_t mapIndex;
+            uint16_t keyCode;
+            uint32_t result;
+            bool isDead;
+        };
+
+        // What a page read from the layout, beyond the settings and the KLE keyboard
+        struct PageTrace
+        {
+            std::vector<KeyQuery> queries;
+            bool usesPath = false;
+        };
+
+        Inputs in;
+        Options opts;
+        const CompiledLayout &layout;
+        const KleTemplate &kleTemplate;
+        const Settings &settings;
+        std::string keyMapSet;
+        uint32_t usedKeyMapSetId;
+        std::vector<uint32_t> stateIds; // Settings states in the layout's string arena
+        uint32_t numShownStates = 0;
+        // Settings state rendered on each page, and page number of each settings state, 0 if it is hidden
+        std::vector<size_t> pageStates;
+        std::vector<uint32_t> statePages;
+        // State paths, computed once per state and by only one thread
+        std::vector<std::string> statePaths;
+        std::vector<uint8_t> statePathComputed;
+        // Incremental cache entries by settings state, null if there is none
+        std::vector<nlohmann::json> pageCache, pathCache;
+        uint64_t transitionHash = 0;
+        std::atomic<size_t> numReusedPages, numRenderedPages;
+        std::unordered_set<UChar32> nonGraphics;
+        std::mutex nonGraphicsMutex;
+        Counters counters;
+        mutable std::mutex countersMutex;
+
+        // Counts the operations and allocations of the calling thread, and adds them to the converter's counters when
+        // it ends
+        class ThreadCounters
+        {
+            public:
+                explicit ThreadCounters(Converter &converter) : converter(converter),
+                        scope(converter.opts.stats ? &counters : nullptr), allocationsStart(Allocations::thread()) {}
+
+                ~ThreadCounters()
+                {
+                    if(!converter.opts.stats) return;
+                    counters.allocations += Allocations::thread().count - allocationsStart.count;
+                    counters.allocatedBytes += Allocations::thread().bytes - allocationsStart.bytes;
+                    std::lock_guard<std::mutex> lock(converter.countersMutex);
+                    converter.counters += counters;
+                }
+
+            private:
+                Converter &converter;
+                Counters counters;
+                Counters::Scope scope;
+                Allocations allocationsStart;
+        };
+
+        std::vector<uint32_t> pageContent(size_t iSettingsState) const;
+        void assignPages();
+        bool isPageRendered(uint32_t page) const;
+        std::pair<uint32_t, bool> keyOutput(uint32_t state, uint16_t mapIndex, uint16_t keyCode,
+                std::vector<KeyQuery> *trace) const;
+        std::string statePath2String(const std::vector<std::vector<KeyWithLevel>> &paths,
+                std::vector<KeyQuery> *trace) const;
+        const std::string &statePath(size_t iSettingsState);
+        void computeStatePaths(const std::vector<size_t> &iSettingsStates);
+        nlohmann::json renderIndex();
+        void renderPage(size_t iSettingsState, uint32_t iState, bool isFirstPage, float firstPageDy,
+                nlohmann::json &pageJson, PageTrace *trace);
+        void renderPageIncremental(size_t iSettingsState, uint32_t iState, bool isFirstPage, float firstPageDy,
+                nlohmann::json &pageJson);
+        nlohmann::json queriesToJson(const std::vector<KeyQuery> &queries, size_t iSettingsState) const;
+        bool queriesHold(const nlohmann::json &queries) const;
+        void loadIncrementalCache();
+        void saveIncrementalCache() const;
+};
+
+/// \brief Renders several keyMapSets of the same inputs concurrently, each one by its own converter. The output file,
+/// split directory and incremental cache of the options are named after each map set: out.json becomes
+/// out.ANSI.json and dir becomes dir/ANSI.
+/// \param output : the output file, it can only be empty with a split directory.
+/// \throw Error if a map set cannot be rendered.
+void convertKeyMapSets(const Inputs &inputs, const Options &options, const std::vector<std::string> &keyMapSets,
+        const std::string &output);
+
+/// \brief Puts shard outputs back together, in the order of a single-process run.
+/// \throw Error if a shard cannot be read or the shards do not match.
+void mergeShards(const std::vector<std::string> &files, std::ostream &out);
+
+}
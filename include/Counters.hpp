@@ -0,0 +1,103 @@
+#pragma once
+
+#include <ostream>
+#include <stdint.h>
+#include "Util.hpp"
+
+/// \file Counters.hpp
+/// \brief Definition for Counters use.
+
+namespace keylayout2kle
+{
+
+/// \brief Operation counts of the hot paths. Each thread counts in its own Counters, installed with Counters::Scope,
+/// so counting is a thread local test and a plain increment, and nothing when no counters are installed.
+struct Counters
+{
+    uint64_t keyOutputCalls = 0;
+    uint64_t baseMapSetFallbacks = 0;
+    uint64_t findStatePathCalls = 0;
+    uint64_t pathsBeforeFilter = 0; ///< Paths found before keeping the shortest ones.
+    uint64_t actionStateCalls = 0;
+    uint64_t breakIterators = 0;
+    uint64_t substitutionHits = 0;
+    uint64_t deadKeyChains[4] = {0, 0, 0, 0}; ///< Dead key legends by chain length, from 1 to 3.
+    uint64_t allocations = 0; ///< Made by the counting threads, if allocations are counted.
+    uint64_t allocatedBytes = 0;
+
+    Counters &operator+=(const Counters &other)
+    {
+        keyOutputCalls += other.keyOutputCalls;
+        baseMapSetFallbacks += other.baseMapSetFallbacks;
+        findStatePathCalls += other.findStatePathCalls;
+        pathsBeforeFilter += other.pathsBeforeFilter;
+        actionStateCalls += other.actionStateCalls;
+        breakIterators += other.breakIterators;
+        substitutionHits += other.substitutionHits;
+        for(int i = 0; i < 4; i++) deadKeyChains[i] += other.deadKeyChains[i];
+        allocations += other.allocations;
+        allocatedBytes += other.allocatedBytes;
+        return *this;
+    }
+
+    /// \brief The counters of the calling thread, null if it does not count.
+    static Counters *&current()
+    {
+        static thread_local Counters *counters = nullptr;
+        return counters;
+    }
+
+    /// \brief Adds to a counter of the calling thread, if it counts.
+    static void add(uint64_t Counters::*counter, uint64_t value = 1)
+    {
+        Counters *counters = current();
+        if(counters) counters->*counter += value;
+    }
+
+    /// \brief Counts a dead key legend with a chain of length dead keys, if the calling thread counts.
+    static void addDeadKeyChain(uint8_t length)
+    {
+        Counters *counters = current();
+        if(counters) counters->deadKeyChains[length]++;
+    }
+
+    /// \brief Makes the calling thread count in counters until its destruction. Does nothing if counters is null.
+    class Scope
+    {
+        public:
+            explicit Scope(Counters *counters) : previous(current())
+            {
+                if(counters) current() = counters;
+            }
+
+            ~Scope()
+            {
+                current() = previous;
+            }
+
+            Scope(const Scope&) = delete;
+            Scope &operator=(const Scope&) = delete;
+
+        private:
+            Counters *previous;
+    };
+
+    void print(std::ostream &out) const
+    {
+        out << "Counters:\n"
+                << "    keyOutput calls:             " << keyOutputCalls << "\n"
+                << "    baseMapSet fallbacks:        " << baseMapSetFallbacks << "\n"
+                << "    findStatePath calls:         " << findStatePathCalls << "\n"
+                << "    paths before length filter:  " << pathsBeforeFilter << "\n"
+                << "    actionState calls:           " << actionStateCalls << "\n"
+                << "    break iterators created:     " << breakIterators << "\n"
+                << "    substitution hits:           " << substitutionHits << "\n"
+                << "    dead key chains of 1, 2, 3:  " << deadKeyChains[1] << ", " << deadKeyChains[2] << ", "
+                << deadKeyChains[3] << "\n";
+        if(Allocations::counted()) out << "    allocations:                 " << allocations << "\n"
+                << "    allocated KiB:               " << allocatedBytes / 1024 << "\n";
+        out.flush();
+    }
+};
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+/// \file Hash128.hpp
+/// \brief Definition for Hash128 use.
+
+namespace keylayout2kle
+{
+
+/// \class Hash128
+/// \brief 128-bit non-cryptographic hash, MurmurHash3 x64_128 by Austin Appleby (public domain).
+/// It tells contents apart for caching, it must not be used against adversarial inputs.
+class Hash128
+{
+    public:
+        uint64_t low = 0, high = 0;
+
+        /// \brief Hashes a buffer.
+        /// \param data : the buffer to hash.
+        /// \param size : its size in bytes.
+        /// \param seed : a different seed gives an unrelated hash.
+        static Hash128 make(const void *data, size_t size, uint64_t seed = 0)
+        {
+            const unsigned char *bytes = static_cast<const unsigned char*>(data);
+            const uint64_t c1 = 0x87c37b91114253d5ull, c2 = 0x4cf5ad432745937full;
+            uint64_t h1 = seed, h2 = seed;
+            size_t numBlocks = size / 16;
+            for(size_t i = 0; i < numBlocks; i++)
+            {
+                uint64_t k1 = load(bytes + i * 16), k2 = load(bytes + i * 16 + 8);
+                k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+                h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+                k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+                h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+            }
+            const unsigned char *tail = bytes + numBlocks * 16;
+            uint64_t k1 = 0, k2 = 0;
+            for(size_t i = size & 15; i > 8; i--) k2 |= static_cast<uint64_t>(tail[i - 1]) << ((i - 9) * 8);
+            for(size_t i = std::min<size_t>(size & 15, 8); i > 0; i--)
+                    k1 |= static_cast<uint64_t>(tail[i - 1]) << ((i - 1) * 8);
+            if((size & 15) > 8)
+            {
+                k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+            }
+            if(size & 15)
+            {
+                k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+            }
+            h1 ^= size; h2 ^= size;
+            h1 += h2; h2 += h1;
+            h1 = fmix(h1); h2 = fmix(h2);
+            h1 += h2; h2 += h1;
+            Hash128 ret;
+            ret.low = h1;
+            ret.high = h2;
+            return ret;
+        }
+
+        static Hash128 make(const std::string &str, uint64_t seed = 0)
+        {
+            return make(str.data(), str.size(), seed);
+        }
+
+        /// \brief Hash of this hash followed by another one, to hash several buffers as one key.
+        Hash128 combine(const Hash128 &other) const
+        {
+            uint64_t words[4] = {low, high, other.low, other.high};
+            return make(words, sizeof(words));
+        }
+
+        /// \brief 32 hexadecimal digits.
+        std::string hex() const
+        {
+            static const char digits[] = "0123456789abcdef";
+            std::string ret(32, '0');
+            for(int i = 0; i < 16; i++)
+            {
+                ret[i] = digits[(high >> (60 - i * 4)) & 15];
+                ret[i + 16] = digits[(low >> (60 - i * 4)) & 15];
+            }
+            return ret;
+        }
+
+        bool operator==(const Hash128 &other) const
+        {
+            return low == other.low && high == other.high;
+        }
+
+    private:
+        static uint64_t rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        static uint64_t fmix(uint64_t k)
+        {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdull;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ull;
+            k ^= k >> 33;
+            return k;
+        }
+
+        // Little endian read, whatever the platform
+        static uint64_t load(const unsigned char *p)
+        {
+            uint64_t ret = 0;
+            for(int i = 7; i >= 0; i--) ret = ret << 8 | p[i];
+            return ret;
+        }
+};
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include "Converter.hpp"
+
+/// \file InputCache.hpp
+/// \brief Definition for InputCache use.
+
+namespace keylayout2kle
+{
+
+/// \class InputCache
+/// \brief Keeps loaded inputs resident, keyed by content hash, so identical inputs are parsed and compiled once.
+/// Entries keep their content and are only used if it is the requested one, so a hash collision is a miss. It is
+/// thread-safe. Concurrent requests for the same content wait for a single load.
+class InputCache
+{
+    public:
+        struct Stats
+        {
+            size_t hits = 0;
+            size_t misses = 0;
+        };
+
+        /// \param maxEntries : how many inputs of each kind are kept, the least recently used ones are dropped.
+        explicit InputCache(size_t maxEntries = 64) : layouts(maxEntries), kleTemplates(maxEntries),
+                settingsCache(maxEntries) {}
+
+        /// \throw Error if the input cannot be read or is invalid.
+        std::shared_ptr<const CompiledLayout> layout(const Source &source);
+        std::shared_ptr<const KleTemplate> kleTemplate(const Source &source);
+        std::shared_ptr<const Settings> settings(const Source &source);
+
+        /// \brief Gets the three inputs, loading the missing ones concurrently.
+        Inputs inputs(const Source &keylayout, const Source &kle, const Source &settings);
+
+        Stats stats() const;
+
+    private:
+        // 128-bit content hash
+        typedef std::pair<uint64_t, uint64_t> Key;
+
+        template<typename T> class Table
+        {
+            public:
+                explicit Table(size_t maxEntries) : maxEntries(maxEntries) {}
+
+                template<typename Loader> std::shared_ptr<const T> get(const std::string &content, Loader load,
+                        Stats &stats, std::mutex &statsMutex);
+
+            private:
+                struct Entry
+                {
+                    std::shared_future<std::shared_ptr<const T>> value;
+                    std::string content;
+                    uint64_t lastUse;
+                    uint64_t generation; // Tells a reloaded entry from an evicted one with the same key
+                };
+
+                size_t maxEntries;
+                uint64_t useCount = 0;
+                std::mutex mutex;
+                std::map<Key, Entry> entries;
+        };
+
+        Table<CompiledLayout> layouts;
+        Table<KleTemplate> kleTemplates;
+        Table<Settings> settingsCache;
+        mutable std::mutex statsMutex;
+        Stats cacheStats;
+};
+
+}
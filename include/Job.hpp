@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "Converter.hpp"
+#include "InputCache.hpp"
+
+/// \file Job.hpp
+/// \brief Conversions described in json, as used by the daemon and batch modes.
+
+namespace keylayout2kle
+{
+
+/// \brief One conversion. Each input is given either as a path ("keylayout", "kle", "settings") or inline
+/// ("keylayoutContent", "kleContent", "settingsContent"). "settingsOverrides" is a json merge patch applied to the
+/// settings, "options" maps command line option names to their values, "minPage" and "maxPage" are shortcuts for
+/// the page range options, and "output" is the file to write.
+struct Job
+{
+    nlohmann::json id; ///< Echoed back, not interpreted.
+    Source keylayout, kle, settings;
+    nlohmann::json settingsOverrides;
+    Options options;
+    std::string output; ///< Empty to get the output back.
+
+    /// \param baseDir : if not empty, relative paths are relative to this directory.
+    /// \throw Error if the job description is invalid.
+    static Job fromJson(const nlohmann::json &json, const std::string &baseDir = std::string());
+
+    /// \brief Runs the job with inputs from the cache.
+    /// \param warnings : receives the warnings.
+    /// \return the output if the job has no output file and no split directory, an empty string otherwise.
+    /// \throw Error if the conversion fails.
+    std::string run(InputCache &cache, std::vector<std::string> &warnings) const;
+};
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "nlohmann/json.hpp"
+#include "Util.hpp"
+
+namespace keylayout2kle
+{
+
+// A KLE keyboard cell, preprocessed once so the keyboard DOM can be released
+struct KleCell
+{
+    enum : uint8_t {TEXT, LAYOUT_KEY, UNKNOWN_KEY} type;
+    nlohmann::json properties;
+    std::string text; // For layout keys, only the name
+    uint16_t keyCode;
+    std::vector<std::string> legends; // Split labels of layout keys, the first one is the name and is left empty
+};
+
+class KleTemplate
+{
+    public:
+        nlohmann::json header;
+        std::vector<std::vector<KleCell>> rows;
+        uint64_t contentHash = 0; ///< Of the KLE json, set by load.
+
+        /// \brief Parses a KLE keyboard and preprocesses its cells.
+        /// \param source : the KLE file or content.
+        /// \param parseTime, templateTime : if not null, set to the parsing and preprocessing times.
+        static std::shared_ptr<const KleTemplate> load(const Source &source, Timing *parseTime = nullptr,
+                Timing *templateTime = nullptr);
+
+        explicit KleTemplate(const nlohmann::json &kleKeyboard);
+};
+
+}
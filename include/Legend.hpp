@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unicode/brkiter.h>
+#include "Settings.hpp"
+
+/// \file Legend.hpp
+/// \brief Definition for LegendDecorator use.
+
+namespace keylayout2kle
+{
+
+/// \class LegendDecorator
+/// \brief Writes the legends of a key to its KLE label: applies the settings' substitutions, shows combining
+/// characters on a dotted circle and puts spans around emojis. It is not thread-safe, each thread needs its own.
+class LegendDecorator
+{
+    public:
+        /// \throw Error if the ICU break iterator cannot be created.
+        explicit LegendDecorator(const Settings &settings);
+
+        /// \brief Appends a decorated legend to a label.
+        /// \return the legend's character if it is a single non-graphic one, U_SENTINEL otherwise.
+        UChar32 decorate(const std::string &legend, std::string &label);
+
+    private:
+        const Settings &settings;
+        std::unique_ptr<icu::BreakIterator> bi;
+};
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "CompiledLayout.hpp"
+#include "Settings.hpp"
+#include "Util.hpp"
+
+/// \file LookupEngine.hpp
+/// \brief Definition for LookupEngine use.
+
+namespace tinyxml2
+{
+    class XMLDocument;
+    class XMLElement;
+}
+
+namespace keylayout2kle
+{
+
+/// \class LookupEngine
+/// \brief Answers the keylayout queries of a conversion, with names instead of string ids so that engines with
+/// different storage can be compared.
+class LookupEngine
+{
+    public:
+        virtual ~LookupEngine() {}
+
+        /// \brief Legend of a key in a state, and whether it leads to a dead key state. The legend is null if the key
+        /// has none.
+        virtual std::pair<const char*, bool> keyOutput(const char *mapName, const char *stateName, uint16_t mapIndex,
+                uint16_t keyCode) const = 0;
+
+        /// \brief Key sequences of depth + 1 keys reaching a state from none, through the keyMaps whose index is in
+        /// usedMapIndices.
+        virtual std::vector<std::vector<KeyWithLevel>> findStatePath(const char *mapName, const char *stateName,
+                uint8_t depth, const std::vector<bool> &usedMapIndices) const = 0;
+};
+
+/// \class XmlEngine
+/// \brief The reference engine: it walks the XML document at each query, as the conversion did before the keylayout
+/// was compiled. It is slow and only meant to check other engines.
+class XmlEngine : public LookupEngine
+{
+    public:
+        /// \throw Error if the keylayout cannot be read or parsed.
+        static std::unique_ptr<XmlEngine> load(const Source &source);
+
+        ~XmlEngine();
+
+        std::pair<const char*, bool> keyOutput(const char *mapName, const char *stateName, uint16_t mapIndex,
+                uint16_t keyCode) const override;
+
+        std::vector<std::vector<KeyWithLevel>> findStatePath(const char *mapName, const char *stateName,
+                uint8_t depth, const std::vector<bool> &usedMapIndices) const override;
+
+    private:
+        XmlEngine();
+
+        const char *actionState(const char *actionName) const;
+        std::vector<std::vector<KeyWithLevel>> findStatePath(const char *mapName, const char *stateName,
+                uint8_t depth, const std::vector<bool> &usedMapIndices,
+                const std::unordered_set<std::string> &forbiddenStates) const;
+
+        std::unique_ptr<tinyxml2::XMLDocument> document;
+        const tinyxml2::XMLElement *keyboardNode = nullptr;
+        const tinyxml2::XMLElement *actionsNode = nullptr;
+};
+
+/// \class CompiledEngine
+/// \brief The engine of the conversion, the compiled layout, behind the names of the interface.
+class CompiledEngine : public LookupEngine
+{
+    public:
+        explicit CompiledEngine(std::shared_ptr<const CompiledLayout> layout) : layout(std::move(layout)) {}
+
+        std::pair<const char*, bool> keyOutput(const char *mapName, const char *stateName, uint16_t mapIndex,
+                uint16_t keyCode) const override;
+
+        std::vector<std::vector<KeyWithLevel>> findStatePath(const char *mapName, const char *stateName,
+                uint8_t depth, const std::vector<bool> &usedMapIndices) const override;
+
+    private:
+        std::shared_ptr<const CompiledLayout> layout;
+};
+
+/// \brief Compares two engines on every keyMapSet, keyMap index and key code of the layout, in every state it names
+/// or the settings list, and on the state paths of the settings states in each of the settings' keyMapSets, searched
+/// as the conversion does. Writes the mismatches and a summary to report.
+/// \return the number of mismatches.
+size_t verifyEngines(const LookupEngine &reference, const LookupEngine &candidate, const CompiledLayout &layout,
+        const Settings &settings, std::ostream &report);
+
+}
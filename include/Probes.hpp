@@ -0,0 +1,41 @@
+#pragma once
+
+/// \file Probes.hpp
+/// \brief Static tracepoints of the conversion, for bpftrace and perf.
+///
+/// With HAVE_SDT, each PROBE macro is a Systemtap SDT probe of the keylayout2kle provider: a nop instruction and a
+/// note in the binary, which tracers turn into a breakpoint when they attach. For example
+/// `bpftrace -e 'usdt:./keylayout2kle:keylayout2kle:page_end { printf("%d %s\n", arg0, str(arg1)); }'`.
+/// Without it, the macros expand to nothing. Probes whose arguments take time to compute are guarded by
+/// PROBE_ENABLED(name), which reads the probe's semaphore and is only true while a tracer is attached.
+///
+/// Probes and their arguments:
+/// - input_loaded(name, wall µs), after each input is loaded: "keylayout", "kle" or "settings".
+/// - page_start(page, state) and page_end(page, state), around the rendering of a page.
+/// - state_path_start(state) and state_path_end(state, depth, number of paths), around a state path search.
+/// - key_lookup(state, keyMap index, key code, legend, is dead), for each key output the conversion reads. The
+///   legend is null if the key has none.
+
+#ifdef HAVE_SDT
+// Each probe has a semaphore, defined in Probes.cpp, that tracers increment while they are attached
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(keylayout2kle, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(keylayout2kle, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(keylayout2kle, name, a, b, c)
+#define PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(keylayout2kle, name, a, b, c, d, e)
+#define PROBE_ENABLED(name) __builtin_expect(keylayout2kle_##name##_semaphore != 0, 0)
+#define PROBE_SEMAPHORES(X) X(input_loaded) X(page_start) X(page_end) X(state_path_start) X(state_path_end) \
+        X(key_lookup)
+#define PROBE_DECLARE_SEMAPHORE(name) extern unsigned short keylayout2kle_##name##_semaphore;
+extern "C"
+{
+    PROBE_SEMAPHORES(PROBE_DECLARE_SEMAPHORE)
+}
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE5(name, a, b, c, d, e)
+#define PROBE_ENABLED(name) false
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "Util.hpp"
+
+/// \file Profile.hpp
+/// \brief Definition for Profile use.
+
+namespace keylayout2kle
+{
+
+/// \class Profile
+/// \brief Wall and CPU times and allocations of the phases and pages of a run. Phases run by several threads add up
+/// the time of each thread, and phases nest: the index includes the state paths it needs.
+class Profile
+{
+    public:
+        struct Entry
+        {
+            std::string name;
+            Timing time;
+            size_t count = 0;
+            size_t peakRss = 0; ///< KiB. The process peak when a phase was last recorded, 0 for a page.
+        };
+
+        /// \brief Times a phase from its creation to its destruction. It does nothing without a profile.
+        class Scope
+        {
+            public:
+                Scope(Profile *profile, const char *phase) : profile(profile), phase(phase),
+                        stopwatch(profile != nullptr) {}
+
+                ~Scope()
+                {
+                    if(profile) profile->add(phase, stopwatch.elapsed());
+                }
+
+                Scope(const Scope&) = delete;
+                Scope &operator=(const Scope&) = delete;
+
+            private:
+                Profile *profile;
+                const char *phase;
+                Stopwatch stopwatch;
+        };
+
+        /// \brief Adds up the time of many short sections of a phase, to record them at once.
+        class Accumulator
+        {
+            public:
+                explicit Accumulator(bool enabled) : enabled(enabled), stopwatch(false) {}
+
+                void start()
+                {
+                    if(enabled) stopwatch.restart();
+                }
+
+                void stop()
+                {
+                    if(enabled) total += stopwatch.elapsed();
+                }
+
+                const Timing &time() const
+                {
+                    return total;
+                }
+
+            private:
+                bool enabled;
+                Stopwatch stopwatch;
+                Timing total;
+        };
+
+        /// \brief Adds time to a phase, and samples the peak RSS. Thread safe.
+        void add(const std::string &phase, const Timing &time);
+
+        /// \brief Records the rendering time and allocations of a page. Thread safe.
+        void addPage(uint32_t page, const std::string &state, const Timing &time);
+
+        /// \brief Phases and pages, by decreasing wall time.
+        std::vector<Entry> phases() const;
+        std::vector<Entry> pages() const;
+
+        /// \brief Writes the phases and the pages as tables. Allocations are only written if they are counted.
+        void print(std::ostream &out) const;
+
+        nlohmann::json toJson() const;
+
+    private:
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> phaseEntries;
+        std::vector<Entry> pageEntries;
+};
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "Hash128.hpp"
+
+/// \file ResultCache.hpp
+/// \brief Definition for ResultCache use.
+
+namespace keylayout2kle
+{
+
+/// \class ResultCache
+/// \brief Conversion outputs stored in a directory, named after the hash of everything they depend on.
+/// The least recently used outputs are removed when the directory grows beyond its size limit.
+class ResultCache
+{
+    public:
+        /// \param dir : the cache directory, created if needed.
+        /// \param maxSize : size limit in bytes.
+        /// \throw Error if the directory cannot be created.
+        ResultCache(const std::string &dir, uint64_t maxSize);
+
+        /// \brief Key of a conversion.
+        /// \param inputs : the content of the inputs.
+        /// \param options : description of the options that change the output.
+        static Hash128 key(const std::vector<const std::string*> &inputs, const std::string &options);
+
+        /// \brief Writes a stored output.
+        /// \return false if there is none.
+        bool fetch(const Hash128 &key, std::ostream &out) const;
+
+        /// \brief New path in the cache directory to write an output to, to be passed to commit. It is different at
+        /// each call, in any process.
+        std::string pendingPath(const Hash128 &key) const;
+
+        /// \brief Stores the output written to pendingPath by renaming it, then evicts old outputs if needed.
+        /// \throw Error if it cannot be stored.
+        void commit(const Hash128 &key, const std::string &pendingPath);
+
+    private:
+        std::string dir;
+        uint64_t maxSize;
+
+        std::string path(const Hash128 &key) const;
+        void evict() const;
+};
+
+}
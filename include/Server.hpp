@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+/// \file Server.hpp
+/// \brief Daemon mode.
+
+namespace keylayout2kle
+{
+
+/// \brief Serves conversions on a Unix domain socket until a shutdown request is received.
+/// Each request is a job (see Job.hpp) on one line, and is answered on one line with {"id", "ok", "output" or
+/// "file", "warnings", "ms"}, or {"id", "ok": false, "error"}. {"command": "stats"} answers the cache hits and
+/// misses and {"command": "shutdown"} stops the server. Requests of all the connections are answered by a pool of
+/// workers, those of one connection in order. A request line longer than 64 MiB closes its connection. Loaded inputs
+/// stay in memory between requests.
+/// \param socketPath : the socket to create. An existing file at this path is removed.
+/// \param numWorkers : number of requests handled concurrently, 0 for the number of hardware threads.
+/// \throw Error if the socket cannot be created.
+void serve(const std::string &socketPath, unsigned numWorkers = 0);
+
+}
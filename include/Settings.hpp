@@ -0,0 +1,73 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "Util.hpp"
+
+namespace keylayout2kle
+{
+
+struct ModifierSettings
+{
+    bool isUsed = false;
+    std::string prefix;
+};
+
+struct LegendSettings
+{
+    uint16_t index;
+    uint16_t place;
+    uint16_t merge[2];
+    enum : uint8_t {NO, SAME, UPPERCASE, LOWERCASE} mergeType = NO;
+    std::string color;
+
+    /// \brief Tells if the legends at the merge places are put together by this merge rule.
+    bool merges(const std::string &legend0, const std::string &legend1) const;
+};
+
+struct StateSettings
+{
+    std::string state;
+    std::string display;
+    std::string legend;
+    bool show;
+};
+
+// The settings json, interpreted. It does not depend on the keylayout.
+class Settings
+{
+    public:
+        std::string keyMapSet; // The first of keyMapSets
+        std::vector<std::string> keyMapSets;
+        std::vector<LegendSettings> legends;
+        uint16_t numLegends = 0;
+        std::vector<bool> placesUsed; // numLegends long
+        std::vector<ModifierSettings> modifiers;
+        std::vector<bool> usedMapIndices; // Same size as modifiers
+        std::vector<StateSettings> states;
+        std::unordered_map<std::string, size_t> stateLookup; // State name to its index in states, the first one wins
+        std::unordered_map<std::string, std::string> substitutions;
+        float stateDy = 0.f;
+        bool hasIndex = false;
+        float indexWidth = 0.f;
+        uint16_t indexNumColumns = 1;
+        uint64_t contentHash = 0; ///< Of the settings json, set by load.
+
+        /// \brief Parses and interprets a settings json.
+        /// \param source : the settings file or content.
+        /// \param parseTime, interpretTime : if not null, set to the parsing and interpretation times.
+        static std::shared_ptr<const Settings> load(const Source &source, Timing *parseTime = nullptr,
+                Timing *interpretTime = nullptr);
+
+        /// \brief Legend of a state, or the name itself if it is not in the settings.
+        std::string stateLegend(const std::string &name) const
+        {
+            auto it = stateLookup.find(name);
+            return it == stateLookup.end() ? name : states[it->second].legend;
+        }
+};
+
+}
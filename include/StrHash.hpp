@@ -2,6 +2,7 @@
 
 #include <unordered_map>
 #include <string>
+#include <stdint.h>
 
 /// StrHash borrowed from project Lazẏnput https://github.com/Sentmoraap/lazynput
 
@@ -71,6 +72,80 @@ class StrHash
         constexpr operator uint32_t() const {return hash;}
 };
 
+/// \class StrHash64
+/// \brief This class computes a C string's 64-bit hash: FNV-1a, mixed by the MurmurHash3 finalizer so that its low
+/// bits can index hash table buckets, unlike StrHash's. It is constexpr too, for switch cases.
+class StrHash64
+{
+    private:
+        /// Empty string state value, the FNV-1a offset basis.
+        static constexpr uint64_t INITIAL_VALUE = 14695981039346656037ull;
+
+        /// Current string state value, before mixing.
+        uint64_t state = INITIAL_VALUE;
+
+        /// \brief Computes a new state based on a previous string's state and an extra character.
+        /// \param chr : the character to append to the previous string.
+        /// \param prevState : the previous string's state value.
+        /// \return the new state value.
+        static constexpr uint64_t hashCharacter(char chr, uint64_t prevState)
+        {
+            return (prevState ^ static_cast<unsigned char>(chr)) * 1099511628211ull;
+        }
+
+        /// \brief Recursive constexpr state computation used by the literal.
+        /// \param str : the string left to hash.
+        /// \param prevState : the hashed part's state value.
+        /// \return the string's state value.
+        static constexpr uint64_t hashString(const char *str, uint64_t prevState)
+        {
+            return *str ? hashString(str + 1, hashCharacter(*str, prevState)) : prevState;
+        }
+
+        static constexpr uint64_t shiftXor(uint64_t value, int shift)
+        {
+            return value ^ (value >> shift);
+        }
+
+        /// \brief MurmurHash3's fmix64, each bit of the state changes half of the hash bits.
+        static constexpr uint64_t mix(uint64_t value)
+        {
+            return shiftXor(shiftXor(shiftXor(value, 33) * 0xff51afd7ed558ccdull, 33) * 0xc4ceb9fe1a85ec53ull, 33);
+        }
+
+        constexpr StrHash64(uint64_t value) : state(value) {};
+
+    public:
+        /// \brief Empty string's hash.
+        constexpr StrHash64() {};
+
+        /// \brief Computes the hash of a C string.
+        /// \param str : the C string to hash.
+        static constexpr StrHash64 make(const char *str)
+        {
+            return StrHash64(hashString(str, INITIAL_VALUE));
+        }
+
+        /// \brief Computes the hash of a C++ string, iteratively.
+        /// \param str : the C++ string to hash.
+        static StrHash64 make(const std::string &str)
+        {
+            StrHash64 ret;
+            for(char chr : str) ret.hashCharacter(chr);
+            return ret;
+        }
+
+        /// \brief Add a character to the hashed string.
+        /// \param chr : the character to append.
+        inline void hashCharacter(char chr)
+        {
+            state = hashCharacter(chr, state);
+        }
+
+        /// \brief Implicit conversion operator to uint64_t, for switches.
+        constexpr operator uint64_t() const {return mix(state);}
+};
+
 /// \class StrHashIdentity
 /// \brief Identity hash function to use pre-hashed strings in unordered_maps.
 class StrHashIdentity
@@ -80,6 +155,11 @@ class StrHashIdentity
         {
             return hash;
         }
+
+        constexpr uint64_t operator()(StrHash64 hash) const
+        {
+            return hash;
+        }
 };
 
 /// \brief unordered_map with StrHash as a prehashed key_type.
@@ -92,3 +172,11 @@ constexpr StrHash operator""_hash(const char *str, std::size_t size)
 {
     return StrHash::make(str);
 }
+
+/// \brief String literal to compute a string's 64-bit hash.
+/// \param str : a C string.
+/// \return the string's hash.
+constexpr StrHash64 operator""_hash64(const char *str, std::size_t size)
+{
+    return StrHash64::make(str);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "Util.hpp"
+
+/// \file Trace.hpp
+/// \brief Definition for Trace use.
+
+namespace keylayout2kle
+{
+
+/// \class Trace
+/// \brief Spans of a run in the Trace Event Format, to be opened in Perfetto or chrome://tracing.
+class Trace
+{
+    public:
+        /// \brief Records a span from its creation to its destruction. It does nothing without a trace.
+        class Span
+        {
+            public:
+                Span(Trace *trace, const char *name, const char *category) : trace(trace), name(name),
+                        category(category)
+                {
+                    if(trace) start = Clock::now();
+                }
+
+                ~Span()
+                {
+                    if(trace) trace->add(name, category, start, Clock::now(), std::move(args));
+                }
+
+                Span(const Span&) = delete;
+                Span &operator=(const Span&) = delete;
+
+                /// \brief Adds an argument shown with the span.
+                template<typename T> void arg(const char *key, T &&value)
+                {
+                    if(trace) args[key] = std::forward<T>(value);
+                }
+
+            private:
+                Trace *trace;
+                const char *name;
+                const char *category;
+                Clock::time_point start;
+                nlohmann::json args;
+        };
+
+        /// \brief Starts the trace. The calling thread is named main.
+        Trace() : start(Clock::now())
+        {
+            threadIds.emplace(std::this_thread::get_id(), 1);
+        }
+
+        /// \brief Adds a span of the calling thread. Thread safe.
+        void add(const std::string &name, const char *category, Clock::time_point spanStart, Clock::time_point spanEnd,
+                nlohmann::json args = nlohmann::json());
+
+        /// \brief Writes the spans as a trace json.
+        void write(std::ostream &out) const;
+
+    private:
+        Clock::time_point start;
+        mutable std::mutex mutex;
+        std::map<std::thread::id, uint32_t> threadIds; // The main thread is 1, the others in order of appearance
+        std::vector<nlohmann::json> events;
+};
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+
+namespace keylayout2kle
+{
+
+/// \brief Error reported by the library instead of exiting.
+class Error : public std::runtime_error
+{
+    public:
+        explicit Error(const std::string &what) : std::runtime_error(what) {}
+};
+
+/// \brief An input, either a file or its content already in memory.
+struct Source
+{
+    std::string path;
+    std::string content;
+    bool inMemory = false;
+
+    static Source file(const std::string &path)
+    {
+        Source source;
+        source.path = path;
+        return source;
+    }
+
+    static Source memory(std::string content)
+    {
+        Source source;
+        source.content = std::move(content);
+        source.inMemory = true;
+        return source;
+    }
+
+    /// \brief Reads the whole input.
+    std::string read() const;
+};
+
+/// \brief 64-bit FNV-1a hash, to tell inputs apart between runs.
+/// \param hash : the hash of the preceding data, to hash several buffers as one.
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for(size_t i = 0; i < size; i++) hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * 1099511628211ull;
+    return hash;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+inline double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/// \brief CPU time used by the calling thread in ms, 0 where unsupported.
+double threadCpuMs();
+
+/// \brief Allocations made by a thread. They are only counted when the library is built with COUNT_ALLOCATIONS,
+/// which replaces the global operator new and delete, and stay at 0 otherwise.
+struct Allocations
+{
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+
+    /// \brief The allocations of the calling thread since it started.
+    static Allocations &thread()
+    {
+        static thread_local Allocations allocations;
+        return allocations;
+    }
+
+    /// \brief Tells if the build counts allocations.
+    static bool counted();
+};
+
+/// \brief Wall and CPU time of a phase, in ms, and the allocations made meanwhile. The CPU time and allocations are
+/// the ones of the thread that ran it.
+struct Timing
+{
+    double wall;
+    double cpu;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+
+    Timing(double wall = 0., double cpu = 0.) : wall(wall), cpu(cpu) {}
+
+    Timing &operator+=(const Timing &other)
+    {
+        wall += other.wall;
+        cpu += other.cpu;
+        allocations += other.allocations;
+        allocatedBytes += other.allocatedBytes;
+        return *this;
+    }
+};
+
+/// \brief Measures the wall and CPU time and the allocations of the calling thread since its creation, or its last
+/// restart.
+class Stopwatch
+{
+    public:
+        Stopwatch()
+        {
+            restart();
+        }
+
+        /// \brief A stopwatch created stopped reads no clock until it is restarted.
+        explicit Stopwatch(bool started)
+        {
+            if(started) restart();
+        }
+
+        void restart()
+        {
+            wallStart = Clock::now();
+            cpuStart = threadCpuMs();
+            allocationsStart = Allocations::thread();
+        }
+
+        Timing elapsed() const
+        {
+            Timing ret(msSince(wallStart), threadCpuMs() - cpuStart);
+            const Allocations &allocations = Allocations::thread();
+            ret.allocations = allocations.count - allocationsStart.count;
+            ret.allocatedBytes = allocations.bytes - allocationsStart.bytes;
+            return ret;
+        }
+
+    private:
+        Clock::time_point wallStart;
+        double cpuStart = 0.;
+        Allocations allocationsStart;
+};
+
+/// \brief Resident set size in KiB, 0 where unsupported.
+size_t currentRss();
+
+/// \brief Peak resident set size in KiB, 0 where unsupported.
+size_t peakRss();
+
+/// \brief Creates a directory if it does not exist yet.
+bool makeDirectory(const std::string &path);
+
+}
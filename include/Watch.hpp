@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include "Converter.hpp"
+
+/// \file Watch.hpp
+/// \brief Watch mode.
+
+namespace keylayout2kle
+{
+
+/// \brief Converts, then converts again each time an input changes, until the process is stopped.
+/// Only the changed inputs are loaded again, and the state paths are kept when neither the keylayout nor the settings
+/// changed. Errors in the inputs are reported and the previous ones are kept.
+/// \param output : the output file, replaced at each conversion. Unused with a split directory.
+/// \throw Error if the inputs cannot be watched or first loaded.
+void watch(const std::string &keylayoutPath, const std::string &klePath, const std::string &settingsPath,
+        const Options &options, const std::string &output);
+
+}
@@ -0,0 +1,45 @@
+#ifndef KEYLAYOUT2KLE_H
+#define KEYLAYOUT2KLE_H
+
+/// \file keylayout2kle.h
+/// \brief C interface of the keylayout2kle library.
+/// Functions that can fail return 0 or NULL and, if error is not NULL, set *error to a message to be released with
+/// keylayout2kle_free.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct keylayout2kle_converter keylayout2kle_converter;
+
+/// \brief Loads the inputs from files and creates a converter.
+keylayout2kle_converter *keylayout2kle_converter_new(const char *keylayoutPath, const char *klePath,
+        const char *settingsPath, char **error);
+
+/// \brief Creates a converter from inputs already in memory.
+keylayout2kle_converter *keylayout2kle_converter_new_from_memory(const char *keylayout, size_t keylayoutSize,
+        const char *kle, size_t kleSize, const char *settings, size_t settingsSize, char **error);
+
+/// \brief Sets an option, named as on the command line without the leading "--". value is ignored by flags.
+/// \return 1 on success, 0 on error.
+int keylayout2kle_set_option(keylayout2kle_converter *converter, const char *name, const char *value, char **error);
+
+/// \brief Converts. In split mode the files are written and *output is an empty string.
+/// \param output : set to the output, to be released with keylayout2kle_free.
+/// \param size : if not NULL, set to the output size.
+/// \return 1 on success, 0 on error.
+int keylayout2kle_convert(keylayout2kle_converter *converter, char **output, size_t *size, char **error);
+
+void keylayout2kle_converter_free(keylayout2kle_converter *converter);
+
+/// \brief Releases a string returned by the library.
+void keylayout2kle_free(char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include "Batch.hpp"
+#include "Job.hpp"
+
+namespace keylayout2kle
+{
+
+bool runBatch(const std::string &manifestPath, unsigned numThreads)
+{
+    Clock::time_point startTime = Clock::now();
+    nlohmann::json manifest;
+    try
+    {
+        manifest = nlohmann::json::parse(Source::file(manifestPath).read());
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        throw Error(manifestPath + ": " + e.what());
+    }
+    if(manifest.type() == nlohmann::json::value_t::object && manifest.contains("jobs")) manifest = manifest.at("jobs");
+    if(manifest.type() != nlohmann::json::value_t::array) throw Error(manifestPath + " does not contain a jobs array");
+    size_t slash = manifestPath.rfind('/');
+    std::string baseDir = slash == std::string::npos ? "." : manifestPath.substr(0, slash);
+
+    struct Result
+    {
+        std::string name;
+        double ms = 0.;
+        std::string error;
+        std::vector<std::string> warnings;
+    };
+    std::vector<Job> jobs(manifest.size());
+    std::vector<Result> results(manifest.size());
+    std::vector<bool> isValid(manifest.size());
+    for(size_t i = 0; i < manifest.size(); i++)
+    {
+        Result &result = results[i];
+        try
+        {
+            jobs[i] = Job::fromJson(manifest[i], baseDir);
+            if(jobs[i].output.empty() && jobs[i].options.splitDir.empty())
+                    throw Error("The job has no output nor split-output");
+            isValid[i] = true;
+        }
+        catch(const Error &e)
+        {
+            result.error = e.what();
+        }
+        const Job &job = jobs[i];
+        if(job.id.type() == nlohmann::json::value_t::string) result.name = job.id.get<std::string>();
+        else if(job.id.type() != nlohmann::json::value_t::null) result.name = job.id.dump();
+        else if(!job.output.empty()) result.name = job.output;
+        else result.name = job.options.splitDir;
+    }
+
+    // All the inputs stay loaded until the end of the batch
+    InputCache cache(std::numeric_limits<size_t>::max());
+    std::atomic<size_t> nextJob(0);
+    auto worker = [&]()
+    {
+        for(size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+        {
+            if(!isValid[i]) continue;
+            Clock::time_point start = Clock::now();
+            try
+            {
+                jobs[i].run(cache, results[i].warnings);
+            }
+            catch(const std::exception &e)
+            {
+                results[i].error = e.what();
+            }
+            results[i].ms = msSince(start);
+        }
+    };
+    if(!numThreads) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < std::min<size_t>(numThreads, jobs.size()); i++) threads.emplace_back(worker);
+    worker();
+    for(std::thread &thread : threads) thread.join();
+
+    size_t numFailed = 0;
+    double jobsTime = 0.;
+    std::cerr << "   job       ms  status\n";
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const Result &result = results[i];
+        for(const std::string &warning : result.warnings) std::cerr << warning << "\n";
+        char line[32];
+        snprintf(line, sizeof(line), "%6zu %8.1f  ", i + 1, result.ms);
+        std::cerr << line << (result.error.empty() ? "ok     " : "FAILED ") << result.name;
+        if(!result.error.empty()) std::cerr << ": " << result.error;
+        std::cerr << "\n";
+        if(!result.error.empty()) numFailed++;
+        jobsTime += result.ms;
+    }
+    InputCache::Stats stats = cache.stats();
+    std::cerr << jobs.size() << " jobs, " << numFailed << " failed, " << stats.misses << " inputs loaded, "
+            << stats.hits << " reused. Jobs total: " << jobsTime << " ms, wall time: " << msSince(startTime) << " ms"
+            << std::endl;
+    return !numFailed;
+}
+
+}
@@ -0,0 +1,100 @@
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include "Job.hpp"
+
+namespace keylayout2kle
+{
+
+Job Job::fromJson(const nlohmann::json &json, const std::string &baseDir)
+{
+    auto resolve = [&baseDir](const std::string &path)
+    {
+        return baseDir.empty() || path.empty() || path[0] == '/' ? path : baseDir + "/" + path;
+    };
+    if(json.type() != nlohmann::json::value_t::object) throw Error("A job must be an object");
+    Job job;
+    if(json.contains("id")) job.id = json.at("id");
+    try
+    {
+        auto source = [&json, &resolve](const char *name, Source &source)
+        {
+            std::string contentName = std::string(name) + "Content";
+            if(json.contains(contentName)) source = Source::memory(json.at(contentName).get<std::string>());
+            else if(json.contains(name)) source = Source::file(resolve(json.at(name).get<std::string>()));
+            else throw Error(std::string("The job has no ") + name);
+        };
+        source("keylayout", job.keylayout);
+        source("kle", job.kle);
+        source("settings", job.settings);
+        if(json.contains("settingsOverrides")) job.settingsOverrides = json.at("settingsOverrides");
+        if(json.contains("minPage")) job.options.set("min-page", std::to_string(json.at("minPage").get<long long>()));
+        if(json.contains("maxPage")) job.options.set("max-page", std::to_string(json.at("maxPage").get<long long>()));
+        if(json.contains("options")) for(auto it = json.at("options").begin(); it != json.at("options").end(); ++it)
+        {
+            switch(it->type())
+            {
+                case nlohmann::json::value_t::string:
+                    job.options.set(it.key(), it->get<std::string>());
+                    break;
+                case nlohmann::json::value_t::boolean:
+                    if(it->get<bool>()) job.options.set(it.key());
+                    break;
+                default:
+                    job.options.set(it.key(), it->dump());
+                    break;
+            }
+        }
+        job.options.validate();
+        job.options.splitDir = resolve(job.options.splitDir);
+        if(json.contains("output")) job.output = resolve(json.at("output").get<std::string>());
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        throw Error(std::string("Invalid job: ") + e.what());
+    }
+    return job;
+}
+
+std::string Job::run(InputCache &cache, std::vector<std::string> &warnings) const
+{
+    Source settingsSource = settings;
+    if(settingsOverrides.type() != nlohmann::json::value_t::null)
+    {
+        // The patched settings are cached under their own content
+        nlohmann::json json;
+        try
+        {
+            json = nlohmann::json::parse(settings.read());
+        }
+        catch(const nlohmann::json::exception &e)
+        {
+            throw Error(std::string("Settings parse fail: ") + e.what());
+        }
+        json.merge_patch(settingsOverrides);
+        settingsSource = Source::memory(json.dump());
+    }
+    Options jobOptions = options;
+    std::mutex warningsMutex;
+    jobOptions.warning = [&warnings, &warningsMutex](const std::string &warning)
+    {
+        std::lock_guard<std::mutex> lock(warningsMutex);
+        warnings.push_back(warning);
+    };
+    Converter converter(cache.inputs(keylayout, kle, settingsSource), jobOptions);
+    if(!output.empty() && options.splitDir.empty())
+    {
+        std::ofstream file(output, std::ios::binary);
+        if(!file) throw Error("Cannot open " + output);
+        converter.convert(file);
+        file.close();
+        if(file.fail()) throw Error("Cannot write " + output);
+        return std::string();
+    }
+    // In split mode nothing is written to the stream
+    std::ostringstream stream;
+    converter.convert(stream);
+    return stream.str();
+}
+
+}
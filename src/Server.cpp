@@ -0,0 +1,301 @@
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "Job.hpp"
+#include "Server.hpp"
+
+namespace keylayout2kle
+{
+
+#ifndef _WIN32
+
+namespace
+{
+    // Longest request line, and most bytes of requests queued by a connection before it is read again
+    const size_t MAX_REQUEST_SIZE = 64 << 20;
+
+    struct Connection
+    {
+        int fd = -1;
+        std::string buffer; // Received data after the last complete line
+        std::deque<std::string> requests;
+        size_t queuedBytes = 0;
+        bool busy = false; // In the ready queue or being answered by a worker
+        bool closing = false; // Not read anymore, closed once no worker uses it
+    };
+
+    bool sendAll(int fd, const std::string &data)
+    {
+        for(size_t sent = 0; sent < data.size();)
+        {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+void serve(const std::string &socketPath, unsigned numWorkers)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(address.sun_path)) throw Error("Socket path too long: " + socketPath);
+    strcpy(address.sun_path, socketPath.c_str());
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0) throw Error(std::string("Cannot create a socket: ") + strerror(errno));
+    unlink(socketPath.c_str());
+    if(bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) || listen(listenFd, 64))
+    {
+        std::string err = strerror(errno);
+        close(listenFd);
+        throw Error("Cannot listen on " + socketPath + ": " + err);
+    }
+    // Written to by the workers to wake up poll when a connection can be read again or closed
+    int wakePipe[2];
+    if(pipe(wakePipe))
+    {
+        std::string err = strerror(errno);
+        close(listenFd);
+        throw Error("Cannot create a pipe: " + err);
+    }
+    for(int fd : wakePipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    // A client closing its connection early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    InputCache cache;
+    std::mutex mutex;
+    std::condition_variable requestReady;
+    // Connections with requests to answer. A connection is in it at most once, and its requests are answered in order.
+    std::deque<std::shared_ptr<Connection>> readyConnections;
+    std::map<int, std::shared_ptr<Connection>> connections;
+    std::atomic<bool> stopping(false);
+
+    auto wake = [&]()
+    {
+        char c = 0;
+        ssize_t ret = write(wakePipe[1], &c, 1);
+        (void)ret; // A full pipe already wakes up poll
+    };
+
+    auto stop = [&]()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(stopping) return;
+        stopping = true;
+        requestReady.notify_all();
+        wake();
+    };
+
+    auto handleRequest = [&](const std::string &line)
+    {
+        nlohmann::json response;
+        Clock::time_point start = Clock::now();
+        try
+        {
+            nlohmann::json request = nlohmann::json::parse(line);
+            if(request.type() == nlohmann::json::value_t::object && request.contains("command"))
+            {
+                std::string command = request.at("command").get<std::string>();
+                if(request.contains("id")) response["id"] = request.at("id");
+                if(command == "shutdown") stop();
+                else if(command == "stats")
+                {
+                    InputCache::Stats stats = cache.stats();
+                    response["hits"] = stats.hits;
+                    response["misses"] = stats.misses;
+                }
+                else throw Error("Unknown command " + command);
+                response["ok"] = true;
+                return response;
+            }
+            Job job = Job::fromJson(request);
+            response["id"] = job.id;
+            std::vector<std::string> warnings;
+            std::string output = job.run(cache, warnings);
+            response["ok"] = true;
+            if(!job.output.empty()) response["file"] = job.output;
+            else if(job.options.splitDir.empty()) response["output"] = std::move(output);
+            response["warnings"] = warnings;
+        }
+        catch(const std::exception &e)
+        {
+            response["ok"] = false;
+            response["error"] = e.what();
+        }
+        response["ms"] = msSince(start);
+        return response;
+    };
+
+    // Answers one request at a time, of any connection. Already received requests are answered before stopping.
+    auto worker = [&]()
+    {
+        for(;;)
+        {
+            std::shared_ptr<Connection> connection;
+            std::string line;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                requestReady.wait(lock, [&]()
+                {
+                    return stopping || !readyConnections.empty();
+                });
+                if(readyConnections.empty()) return;
+                connection = readyConnections.front();
+                readyConnections.pop_front();
+                line = std::move(connection->requests.front());
+                connection->requests.pop_front();
+                connection->queuedBytes -= line.size();
+            }
+            bool sent = sendAll(connection->fd, handleRequest(line).dump() + "\n");
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!sent)
+                {
+                    connection->closing = true;
+                    connection->requests.clear();
+                    connection->queuedBytes = 0;
+                }
+                if(connection->requests.empty()) connection->busy = false;
+                else
+                {
+                    readyConnections.push_back(connection);
+                    requestReady.notify_one();
+                }
+            }
+            wake();
+        }
+    };
+
+    // Reads the connections and queues their complete lines
+    auto receive = [&](Connection &connection)
+    {
+        char chunk[1 << 16];
+        ssize_t n = recv(connection.fd, chunk, sizeof(chunk), 0);
+        if(n < 0 && errno == EINTR) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if(n <= 0)
+        {
+            // Answer the requests already received, then close
+            connection.closing = true;
+            return;
+        }
+        connection.buffer.append(chunk, static_cast<size_t>(n));
+        size_t lineStart = 0, newLine;
+        while((newLine = connection.buffer.find('\n', lineStart)) != std::string::npos)
+        {
+            std::string line = connection.buffer.substr(lineStart, newLine - lineStart);
+            lineStart = newLine + 1;
+            if(line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            connection.queuedBytes += line.size();
+            connection.requests.push_back(std::move(line));
+        }
+        connection.buffer.erase(0, lineStart);
+        if(connection.buffer.size() > MAX_REQUEST_SIZE)
+        {
+            std::cerr << "Request longer than " << MAX_REQUEST_SIZE << " bytes, closing its connection" << std::endl;
+            connection.buffer.clear();
+            connection.closing = true;
+        }
+        if(!connection.busy && !connection.requests.empty())
+        {
+            connection.busy = true;
+            readyConnections.push_back(connections.at(connection.fd));
+            requestReady.notify_one();
+        }
+    };
+
+    if(!numWorkers) numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < numWorkers; i++) workers.emplace_back(worker);
+    std::vector<pollfd> pollFds;
+    std::vector<std::shared_ptr<Connection>> polled;
+    while(!stopping)
+    {
+        pollFds.assign({pollfd{wakePipe[0], POLLIN, 0}, pollfd{listenFd, POLLIN, 0}});
+        polled.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto it = connections.begin(); it != connections.end();)
+            {
+                Connection &connection = *it->second;
+                if(connection.closing && !connection.busy)
+                {
+                    close(connection.fd);
+                    it = connections.erase(it);
+                    continue;
+                }
+                // Stop reading a connection that sends requests faster than they are answered
+                if(!connection.closing && connection.queuedBytes < MAX_REQUEST_SIZE)
+                {
+                    pollFds.push_back(pollfd{connection.fd, POLLIN, 0});
+                    polled.push_back(it->second);
+                }
+                ++it;
+            }
+        }
+        if(poll(pollFds.data(), pollFds.size(), -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            std::cerr << "poll: " << strerror(errno) << std::endl;
+            break;
+        }
+        if(pollFds[0].revents)
+        {
+            char drain[256];
+            while(read(wakePipe[0], drain, sizeof(drain)) > 0) {}
+        }
+        if(pollFds[1].revents)
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if(fd >= 0)
+            {
+                std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+                connection->fd = fd;
+                std::lock_guard<std::mutex> lock(mutex);
+                connections.emplace(fd, connection);
+            }
+            else if(errno != EINTR && errno != ECONNABORTED)
+            {
+                if(!stopping) std::cerr << "accept: " << strerror(errno) << std::endl;
+                break;
+            }
+        }
+        for(size_t i = 0; i < polled.size(); i++) if(pollFds[i + 2].revents) receive(*polled[i]);
+    }
+    stop();
+    for(std::thread &thread : workers) thread.join();
+    for(auto &connection : connections) close(connection.first);
+    for(int fd : wakePipe) close(fd);
+    close(listenFd);
+    unlink(socketPath.c_str());
+}
+
+#else
+
+void serve(const std::string &socketPath, unsigned numWorkers)
+{
+    throw Error("--serve is not supported on this platform");
+}
+
+#endif
+
+}
@@ -0,0 +1,150 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include "Watch.hpp"
+
+namespace keylayout2kle
+{
+
+#ifdef __linux__
+
+namespace
+{
+    enum Input : uint8_t {KEYLAYOUT = 1, KLE = 2, SETTINGS = 4};
+
+    void convert(Converter &converter, const std::string &output)
+    {
+        if(!converter.options().splitDir.empty())
+        {
+            converter.convert(std::cout);
+            return;
+        }
+        // Readers of the output never see a partial file
+        std::string tmpPath = output + ".tmp";
+        std::ofstream file(tmpPath, std::ios::binary);
+        if(!file) throw Error("Cannot open " + tmpPath);
+        converter.convert(file);
+        file.close();
+        if(file.fail() || rename(tmpPath.c_str(), output.c_str())) throw Error("Cannot write " + output);
+    }
+}
+
+void watch(const std::string &keylayoutPath, const std::string &klePath, const std::string &settingsPath,
+        const Options &options, const std::string &output)
+{
+    if(output.empty() && options.splitDir.empty()) throw Error("--watch needs --output or --split-output");
+    int fd = inotify_init1(IN_CLOEXEC);
+    if(fd < 0) throw Error(std::string("inotify: ") + strerror(errno));
+    // Directories are watched rather than files, editors often save by replacing the file
+    std::map<int, std::map<std::string, uint8_t>> watched;
+    auto addWatch = [fd, &watched](const std::string &path, Input input)
+    {
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash ? path.substr(0, slash) : "/";
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if(wd < 0) throw Error("Cannot watch " + dir + ": " + strerror(errno));
+        watched[wd][name] |= input;
+    };
+    try
+    {
+        addWatch(keylayoutPath, KEYLAYOUT);
+        addWatch(klePath, KLE);
+        addWatch(settingsPath, SETTINGS);
+    }
+    catch(...)
+    {
+        close(fd);
+        throw;
+    }
+
+    Clock::time_point start = Clock::now();
+    Inputs inputs = loadInputs(Source::file(keylayoutPath), Source::file(klePath), Source::file(settingsPath));
+    std::unique_ptr<Converter> converter(new Converter(inputs, options));
+    convert(*converter, output);
+    std::cerr << "Generated in " << msSince(start) << " ms, watching for changes" << std::endl;
+
+    alignas(inotify_event) char buffer[4096];
+    for(;;)
+    {
+        // Wait for a change, then let the burst of events of a save settle
+        uint8_t changed = 0;
+        int timeout = -1;
+        for(;;)
+        {
+            pollfd pfd = {fd, POLLIN, 0};
+            int ret = poll(&pfd, 1, timeout);
+            if(ret < 0 && errno == EINTR) continue;
+            if(ret < 0) throw Error(std::string("poll: ") + strerror(errno));
+            if(!ret) break;
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if(length < 0 && errno == EINTR) continue;
+            if(length <= 0) throw Error(std::string("inotify: ") + strerror(errno));
+            for(char *p = buffer; p < buffer + length;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event*>(p);
+                auto dir = watched.find(event->wd);
+                if(dir != watched.end() && event->len)
+                {
+                    auto file = dir->second.find(event->name);
+                    if(file != dir->second.end()) changed |= file->second;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+            if(changed) timeout = 50;
+        }
+
+        start = Clock::now();
+        try
+        {
+            Inputs newInputs = converter->inputs();
+            std::string what;
+            if(changed & KEYLAYOUT)
+            {
+                newInputs.layout = CompiledLayout::load(Source::file(keylayoutPath));
+                what += " keylayout";
+            }
+            if(changed & KLE)
+            {
+                newInputs.kleTemplate = KleTemplate::load(Source::file(klePath));
+                what += " kle";
+            }
+            if(changed & SETTINGS)
+            {
+                newInputs.settings = Settings::load(Source::file(settingsPath));
+                what += " settings";
+            }
+            double loadTime = msSince(start);
+            std::unique_ptr<Converter> newConverter(new Converter(newInputs, options));
+            newConverter->reuseStatePaths(*converter);
+            convert(*newConverter, output);
+            converter = std::move(newConverter);
+            std::cerr << "Changed:" << what << ". Regenerated in " << msSince(start) << " ms (loading " << loadTime
+                    << " ms)" << std::endl;
+        }
+        catch(const std::exception &e)
+        {
+            std::cerr << e.what() << "\nKeeping the previous inputs" << std::endl;
+        }
+    }
+}
+
+#else
+
+void watch(const std::string &keylayoutPath, const std::string &klePath, const std::string &settingsPath,
+        const Options &options, const std::string &output)
+{
+    throw Error("--watch is not supported on this platform");
+}
+
+#endif
+
+}
@@ -0,0 +1,73 @@
+#include <cstdlib>
+#include <new>
+#include "Util.hpp"
+
+namespace keylayout2kle
+{
+
+bool Allocations::counted()
+{
+#ifdef COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
+
+#ifdef COUNT_ALLOCATIONS
+// Replaces the global operators of the whole program, so the library is only built this way on request. Counting is
+// a thread local increment, the memory comes from malloc.
+void *operator new(std::size_t size)
+{
+    keylayout2kle::Allocations &allocations = keylayout2kle::Allocations::thread();
+    allocations.count++;
+    allocations.bytes += size;
+    void *ptr = malloc(size ? size : 1);
+    if(!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return operator new(size);
+    }
+    catch(const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t&) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept
+{
+    free(ptr);
+}
+#endif
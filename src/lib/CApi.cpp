@@ -0,0 +1,109 @@
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include "Converter.hpp"
+#include "keylayout2kle.h"
+
+using namespace keylayout2kle;
+
+// Options are only applied when converting, so they can be set in any order
+struct keylayout2kle_converter
+{
+    Inputs inputs;
+    Options options;
+};
+
+namespace
+{
+    char *copyString(const std::string &str)
+    {
+        char *ret = static_cast<char*>(malloc(str.size() + 1));
+        if(ret) memcpy(ret, str.c_str(), str.size() + 1);
+        return ret;
+    }
+
+    void setError(char **error, const char *what)
+    {
+        if(error) *error = copyString(what);
+    }
+
+    keylayout2kle_converter *newConverter(const Source &keylayout, const Source &kle, const Source &settings,
+            char **error)
+    {
+        try
+        {
+            keylayout2kle_converter *converter = new keylayout2kle_converter;
+            try
+            {
+                converter->inputs = loadInputs(keylayout, kle, settings);
+            }
+            catch(...)
+            {
+                delete converter;
+                throw;
+            }
+            return converter;
+        }
+        catch(const std::exception &e)
+        {
+            setError(error, e.what());
+            return nullptr;
+        }
+    }
+}
+
+keylayout2kle_converter *keylayout2kle_converter_new(const char *keylayoutPath, const char *klePath,
+        const char *settingsPath, char **error)
+{
+    return newConverter(Source::file(keylayoutPath), Source::file(klePath), Source::file(settingsPath), error);
+}
+
+keylayout2kle_converter *keylayout2kle_converter_new_from_memory(const char *keylayout, size_t keylayoutSize,
+        const char *kle, size_t kleSize, const char *settings, size_t settingsSize, char **error)
+{
+    return newConverter(Source::memory(std::string(keylayout, keylayoutSize)),
+            Source::memory(std::string(kle, kleSize)), Source::memory(std::string(settings, settingsSize)), error);
+}
+
+int keylayout2kle_set_option(keylayout2kle_converter *converter, const char *name, const char *value, char **error)
+{
+    try
+    {
+        converter->options.set(name, value ? value : "");
+        return 1;
+    }
+    catch(const std::exception &e)
+    {
+        setError(error, e.what());
+        return 0;
+    }
+}
+
+int keylayout2kle_convert(keylayout2kle_converter *converter, char **output, size_t *size, char **error)
+{
+    try
+    {
+        std::ostringstream stream;
+        Converter(converter->inputs, converter->options).convert(stream);
+        std::string str = stream.str();
+        *output = copyString(str);
+        if(!*output) throw std::bad_alloc();
+        if(size) *size = str.size();
+        return 1;
+    }
+    catch(const std::exception &e)
+    {
+        setError(error, e.what());
+        return 0;
+    }
+}
+
+void keylayout2kle_converter_free(keylayout2kle_converter *converter)
+{
+    delete converter;
+}
+
+void keylayout2kle_free(char *str)
+{
+    free(str);
+}
@@ -0,0 +1,293 @@
+#include <tinyxml2.h>
+#include "CompiledLayout.hpp"
+#include "Counters.hpp"
+
+// Counts the visited elements in numXmlElements
+#define ITERATE_CHILDREN(NODE, VAR, STR) for(const tinyxml2::XMLElement *VAR = NODE->FirstChildElement(STR);\
+        VAR && ++numXmlElements; VAR = VAR->NextSiblingElement(STR))
+
+namespace keylayout2kle
+{
+
+const uint32_t StringArena::NONE;
+const uint32_t StringArena::UNKNOWN;
+
+std::shared_ptr<const CompiledLayout> CompiledLayout::load(const Source &source, Timing *loadTime,
+        Timing *compileTime)
+{
+    tinyxml2::XMLDocument rootNode;
+    Stopwatch stopwatch;
+    tinyxml2::XMLError xmlError = source.inMemory ? rootNode.Parse(source.content.c_str(), source.content.size())
+            : rootNode.LoadFile(source.path.c_str());
+    if(loadTime) *loadTime = stopwatch.elapsed();
+    if(xmlError != tinyxml2::XML_SUCCESS || !rootNode.FirstChildElement()) throw Error("Xml parse fail");
+    stopwatch = Stopwatch();
+    std::shared_ptr<const CompiledLayout> layout = std::make_shared<CompiledLayout>(rootNode.FirstChildElement());
+    if(compileTime) *compileTime = stopwatch.elapsed();
+    if(layout->keyMapSets.empty()) throw Error("Xml parse fail");
+    return layout;
+}
+
+CompiledLayout::CompiledLayout(const tinyxml2::XMLNode *keyboardNode)
+{
+    auto intern = [this](const char *str)
+    {
+        return str ? strings.intern(str) : StringArena::NONE;
+    };
+    noneState = intern("none");
+    std::unordered_map<uint32_t, uint32_t> lastActionWithId;
+    const tinyxml2::XMLElement *actionsNode = keyboardNode->FirstChildElement("actions");
+    if(actionsNode) ITERATE_CHILDREN(actionsNode, actionSet, "action")
+    {
+        CompiledAction action;
+        action.id = intern(actionSet->Attribute("id"));
+        action.nextSameId = StringArena::NONE;
+        action.firstWhen = static_cast<uint32_t>(whens.size());
+        ITERATE_CHILDREN(actionSet, when, "when") whens.push_back(CompiledWhen{intern(when->Attribute("state")),
+                intern(when->Attribute("output")), intern(when->Attribute("next"))});
+        action.numWhens = static_cast<uint32_t>(whens.size()) - action.firstWhen;
+        uint32_t actionIndex = static_cast<uint32_t>(actions.size());
+        auto it = lastActionWithId.find(action.id);
+        if(it != lastActionWithId.end())
+        {
+            actions[it->second].nextSameId = actionIndex;
+            it->second = actionIndex;
+        }
+        else lastActionWithId.emplace(action.id, actionIndex);
+        actions.push_back(action);
+    }
+    std::unordered_map<uint32_t, uint32_t> firstActionWithId;
+    for(uint32_t i = static_cast<uint32_t>(actions.size()); i-- > 0;) firstActionWithId[actions[i].id] = i;
+    ITERATE_CHILDREN(keyboardNode, keyMapSetNode, "keyMapSet")
+    {
+        CompiledKeyMapSet keyMapSet;
+        keyMapSet.id = intern(keyMapSetNode->Attribute("id"));
+        keyMapSet.firstKeyMap = static_cast<uint32_t>(keyMaps.size());
+        ITERATE_CHILDREN(keyMapSetNode, keyMapNode, "keyMap")
+        {
+            CompiledKeyMap keyMap;
+            keyMap.index = keyMapNode->IntAttribute("index");
+            keyMap.baseMapSet = intern(keyMapNode->Attribute("baseMapSet"));
+            keyMap.baseIndex = keyMapNode->IntAttribute("baseIndex");
+            keyMap.firstKey = static_cast<uint32_t>(keys.size());
+            ITERATE_CHILDREN(keyMapNode, keyNode, "key")
+            {
+                CompiledKey key;
+                key.code = keyNode->IntAttribute("code");
+                key.output = intern(keyNode->Attribute("output"));
+                key.action = intern(keyNode->Attribute("action"));
+                auto it = firstActionWithId.find(key.action);
+                key.actionIndex = it == firstActionWithId.end() ? StringArena::NONE : it->second;
+                keys.push_back(key);
+            }
+            keyMap.numKeys = static_cast<uint32_t>(keys.size()) - keyMap.firstKey;
+            keyMaps.push_back(keyMap);
+        }
+        keyMapSet.numKeyMaps = static_cast<uint32_t>(keyMaps.size()) - keyMapSet.firstKeyMap;
+        keyMapSets.push_back(keyMapSet);
+    }
+    strings.shrink();
+    keyMapSets.shrink_to_fit();
+    keyMaps.shrink_to_fit();
+    keys.shrink_to_fit();
+    actions.shrink_to_fit();
+    whens.shrink_to_fit();
+}
+
+std::pair<uint32_t, bool> CompiledLayout::keyOutput(uint32_t mapName, uint32_t stateName, uint16_t mapIndex,
+        uint16_t keyCode) const
+{
+    Counters::add(&Counters::keyOutputCalls);
+    const CompiledKey *foundKey = nullptr;
+    const CompiledKeyMap *foundKeyMap = nullptr;
+    for(const CompiledKeyMapSet &keyMapSet : keyMapSets)
+    {
+        if(keyMapSet.id != mapName) continue;
+        for(uint32_t i = 0; i < keyMapSet.numKeyMaps; i++)
+        {
+            const CompiledKeyMap &keyMap = keyMaps[keyMapSet.firstKeyMap + i];
+            if(keyMap.index != mapIndex) continue;
+            foundKeyMap = &keyMap;
+            for(uint32_t j = 0; j < keyMap.numKeys; j++)
+            {
+                const CompiledKey &key = keys[keyMap.firstKey + j];
+                if(key.code == keyCode)
+                {
+                    if(key.output != StringArena::NONE) return std::make_pair(key.output, false);
+                    foundKey = &key;
+                    break;
+                }
+            }
+            break;
+        }
+        break;
+    }
+    if(foundKey && foundKey->action != StringArena::NONE)
+    {
+        if(foundKey->actionIndex != StringArena::NONE)
+        {
+            const CompiledAction &action = actions[foundKey->actionIndex];
+            for(uint32_t i = 0; i < action.numWhens; i++)
+            {
+                const CompiledWhen &when = whens[action.firstWhen + i];
+                if(when.state != stateName) continue;
+                if(when.output != StringArena::NONE) return std::make_pair(when.output, false);
+                if(when.next != StringArena::NONE) return std::make_pair(when.next, true);
+                break;
+            }
+        }
+    }
+    else if(foundKeyMap && foundKeyMap->baseMapSet != StringArena::NONE)
+    {
+        Counters::add(&Counters::baseMapSetFallbacks);
+        return keyOutput(foundKeyMap->baseMapSet, stateName, static_cast<uint16_t>(foundKeyMap->baseIndex), keyCode);
+    }
+    return std::make_pair(StringArena::NONE, false);
+}
+
+uint32_t CompiledLayout::actionState(uint32_t actionIndex) const
+{
+    Counters::add(&Counters::actionStateCalls);
+    for(uint32_t a = actionIndex; a != StringArena::NONE; a = actions[a].nextSameId)
+    {
+        const CompiledAction &action = actions[a];
+        for(uint32_t i = 0; i < action.numWhens; i++)
+        {
+            const CompiledWhen &when = whens[action.firstWhen + i];
+            if(when.state != noneState) continue;
+            if(when.output != StringArena::NONE) return StringArena::NONE;
+            return when.next;
+        }
+    }
+    return StringArena::NONE;
+}
+
+std::vector<std::vector<KeyWithLevel>> CompiledLayout::findStatePath(uint32_t mapName, uint32_t stateName,
+        uint8_t depth, const std::vector<bool> &usedMapIndices, const std::unordered_set<uint32_t> &forbiddenStates)
+        const
+{
+    Counters::add(&Counters::findStatePathCalls);
+    std::vector<std::vector<KeyWithLevel>> ret;
+    if(stateName == noneState)
+    {
+        ret.resize(1);
+        return ret;
+    }
+    std::unordered_set<uint32_t> newForbiddenStates = forbiddenStates;
+    newForbiddenStates.insert(stateName);
+    auto processKeyMap = [this, depth, mapName, stateName, &usedMapIndices, &ret, &forbiddenStates,
+            &newForbiddenStates](const CompiledKeyMap &keyMap, uint16_t mapIndex)
+    {
+        for(uint32_t j = 0; j < keyMap.numKeys; j++)
+        {
+            const CompiledKey &key = keys[keyMap.firstKey + j];
+            uint16_t keyCode = static_cast<uint16_t>(key.code);
+            if(key.action == StringArena::NONE) continue;
+            if(depth == 0)
+            {
+                if(stateName == actionState(key.actionIndex))
+                {
+                    std::vector<KeyWithLevel> newPath;
+                    newPath.push_back(KeyWithLevel{mapIndex, keyCode});
+                    ret.push_back(newPath);
+                }
+            }
+            else for(uint32_t a = key.actionIndex; a != StringArena::NONE; a = actions[a].nextSameId)
+            {
+                const CompiledAction &action = actions[a];
+                for(uint32_t i = 0; i < action.numWhens; i++)
+                {
+                    const CompiledWhen &when = whens[action.firstWhen + i];
+                    if(when.state == noneState) continue;
+                    if(forbiddenStates.count(when.state)) continue;
+                    if(when.output != StringArena::NONE) continue;
+                    if(when.next == stateName)
+                    {
+                        std::vector<std::vector<KeyWithLevel>> paths =
+                                findStatePath(mapName, when.state, depth - 1, usedMapIndices, newForbiddenStates);
+                        for(std::vector<KeyWithLevel> &vec : paths)
+                        {
+                            ret.push_back(std::move(vec));
+                            ret.back().push_back(KeyWithLevel{mapIndex, keyCode});
+                        }
+                    }
+                }
+            }
+        }
+    };
+    for(const CompiledKeyMapSet &keyMapSet : keyMapSets)
+    {
+        if(keyMapSet.id != mapName) continue;
+        for(uint32_t i = 0; i < keyMapSet.numKeyMaps; i++)
+        {
+            const CompiledKeyMap &keyMap = keyMaps[keyMapSet.firstKeyMap + i];
+            uint16_t mapIndex = static_cast<uint16_t>(keyMap.index);
+            if(mapIndex >= usedMapIndices.size() || !usedMapIndices[mapIndex]) continue;
+            processKeyMap(keyMap, mapIndex);
+            if(keyMap.baseMapSet != StringArena::NONE)
+            {
+                uint16_t baseIndex = static_cast<uint16_t>(keyMap.baseIndex);
+                for(const CompiledKeyMapSet &baseKeyMapSet : keyMapSets)
+                {
+                    if(baseKeyMapSet.id != keyMap.baseMapSet) continue;
+                    for(uint32_t j = 0; j < baseKeyMapSet.numKeyMaps; j++)
+                    {
+                        const CompiledKeyMap &baseKeyMap = keyMaps[baseKeyMapSet.firstKeyMap + j];
+                        if(baseKeyMap.index != baseIndex) continue;
+                        processKeyMap(baseKeyMap, mapIndex);
+                    }
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+uint64_t CompiledLayout::transitionHash() const
+{
+    // Strings are hashed rather than ids, ids change with unrelated edits
+    uint64_t hash = fnv1a(nullptr, 0);
+    auto hashString = [this, &hash](uint32_t id)
+    {
+        const char *str = strings.str(id);
+        if(str) hash = fnv1a(str, strlen(str) + 1, hash);
+        else hash = fnv1a(&id, sizeof(id), hash);
+    };
+    auto hashInt = [&hash](int value)
+    {
+        hash = fnv1a(&value, sizeof(value), hash);
+    };
+    for(const CompiledKeyMapSet &keyMapSet : keyMapSets)
+    {
+        hashString(keyMapSet.id);
+        hashInt(keyMapSet.numKeyMaps);
+        for(uint32_t i = 0; i < keyMapSet.numKeyMaps; i++)
+        {
+            const CompiledKeyMap &keyMap = keyMaps[keyMapSet.firstKeyMap + i];
+            hashInt(keyMap.index);
+            hashString(keyMap.baseMapSet);
+            hashInt(keyMap.baseIndex);
+            hashInt(keyMap.numKeys);
+            for(uint32_t j = 0; j < keyMap.numKeys; j++)
+            {
+                hashInt(keys[keyMap.firstKey + j].code);
+                hashString(keys[keyMap.firstKey + j].action);
+            }
+        }
+    }
+    for(const CompiledAction &action : actions)
+    {
+        hashString(action.id);
+        hashInt(action.numWhens);
+        for(uint32_t i = 0; i < action.numWhens; i++)
+        {
+            const CompiledWhen &when = whens[action.firstWhen + i];
+            hashString(when.state);
+            hashString(when.output);
+            hashString(when.next);
+        }
+    }
+    return hash;
+}
+
+}
@@ -0,0 +1,1107 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <unicode/unistr.h>
+#include <unicode/brkiter.h>
+#include <unicode/normlzr.h>
+#include "StrHash.hpp"
+#include "CompressedStreamBuf.hpp"
+#include "Converter.hpp"
+#include "Legend.hpp"
+#include "Probes.hpp"
+
+namespace keylayout2kle
+{
+
+Inputs loadInputs(const Source &keylayout, const Source &kle, const Source &settings, Trace *trace)
+{
+    // The XML document only lives until the layout is compiled
+    Inputs inputs;
+    LoadTimings &timings = inputs.timings;
+    size_t &loadedRss = inputs.loadedRss;
+    std::future<std::shared_ptr<const CompiledLayout>> layoutFuture = std::async(std::launch::async,
+            [&keylayout, &timings, &loadedRss, trace]()
+    {
+        Trace::Span span(trace, "keylayout", "load");
+        std::shared_ptr<const CompiledLayout> layout = CompiledLayout::load(keylayout, &timings.keylayoutLoad,
+                &timings.keylayoutCompile);
+        loadedRss = currentRss();
+        PROBE2(input_loaded, "keylayout", static_cast<uint64_t>(1000. * (timings.keylayoutLoad.wall
+                + timings.keylayoutCompile.wall)));
+        span.arg("xmlLoadMs", timings.keylayoutLoad.wall);
+        span.arg("compileMs", timings.keylayoutCompile.wall);
+        return layout;
+    });
+    std::future<std::shared_ptr<const KleTemplate>> kleFuture = std::async(std::launch::async,
+            [&kle, &timings, trace]()
+    {
+        Trace::Span span(trace, "kle", "load");
+        std::shared_ptr<const KleTemplate> kleTemplate = KleTemplate::load(kle, &timings.kleParse,
+                &timings.kleTemplate);
+        PROBE2(input_loaded, "kle", static_cast<uint64_t>(1000. * (timings.kleParse.wall + timings.kleTemplate.wall)));
+        span.arg("parseMs", timings.kleParse.wall);
+        span.arg("templateMs", timings.kleTemplate.wall);
+        return kleTemplate;
+    });
+    {
+        Trace::Span span(trace, "settings", "load");
+        inputs.settings = Settings::load(settings, &timings.settingsParse, &timings.settingsInterpret);
+        PROBE2(input_loaded, "settings", static_cast<uint64_t>(1000. * (timings.settingsParse.wall
+                + timings.settingsInterpret.wall)));
+        span.arg("parseMs", timings.settingsParse.wall);
+        span.arg("interpretMs", timings.settingsInterpret.wall);
+    }
+    inputs.layout = layoutFuture.get();
+    inputs.kleTemplate = kleFuture.get();
+    return inputs;
+}
+
+bool Options::takesValue(const std::string &name)
+{
+    switch(StrHash64::make(name))
+    {
+        case "min-page"_hash64:
+        case "max-page"_hash64:
+        case "shard"_hash64:
+        case "shard-mode"_hash64:
+        case "split-output"_hash64:
+        case "incremental-cache"_hash64:
+        case "compress"_hash64:
+        case "keymapset"_hash64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Options::set(const std::string &name, const std::string &value)
+{
+    switch(StrHash64::make(name))
+    {
+        case "min-page"_hash64:
+        case "max-page"_hash64:
+        {
+            long long int val = strtoll(value.c_str(), nullptr, 0);
+            if(val < 0 || val > LAST_PAGE) warn("--" + name + ": improper argument");
+            else (name == "min-page" ? minPage : maxPage) = static_cast<uint32_t>(val);
+            break;
+        }
+        case "shard"_hash64:
+        {
+            char *end;
+            long long int index = strtoll(value.c_str(), &end, 10);
+            long long int count = *end == '/' ? strtoll(end + 1, nullptr, 10) : 0;
+            if(count < 1 || count > LAST_PAGE || index < 1 || index > count)
+                    throw Error("--shard: improper argument, expected <i>/<n> with 1 <= i <= n");
+            shardIndex = static_cast<uint32_t>(index);
+            numShards = static_cast<uint32_t>(count);
+            break;
+        }
+        case "shard-mode"_hash64:
+            switch(StrHash64::make(value))
+            {
+                case "round-robin"_hash64:
+                    shardMode = ROUND_ROBIN;
+                    break;
+                case "balanced"_hash64:
+                    shardMode = BALANCED;
+                    break;
+                default:
+                    throw Error("--shard-mode: unknown mode " + value);
+            }
+            break;
+        case "split-output"_hash64:
+            splitDir = value;
+            break;
+        case "split-index"_hash64:
+            splitIndex = true;
+            break;
+        case "keymapset"_hash64:
+            keyMapSet = value;
+            break;
+        case "no-index"_hash64:
+            indexMode = NO_INDEX;
+            break;
+        case "index-only"_hash64:
+            indexMode = INDEX_ONLY;
+            break;
+        case "dedupe-pages"_hash64:
+            dedupePages = true;
+            break;
+        case "stats"_hash64:
+            stats = true;
+            break;
+        case "incremental-cache"_hash64:
+            incrementalCache = value;
+            break;
+        case "compress"_hash64:
+        {
+            CompressedStreamBuf::Format format;
+            switch(StrHash64::make(value))
+            {
+                case "gzip"_hash64:
+                    format = CompressedStreamBuf::GZIP;
+                    break;
+                case "zstd"_hash64:
+                    format = CompressedStreamBuf::ZSTD;
+                    break;
+                default:
+                    throw Error("--compress: unknown format " + value);
+            }
+            if(!CompressedStreamBuf::isSupported(format))
+                    throw Error("--compress: " + value + " is not supported by this build");
+            compressFormat = format;
+            compress = true;
+            break;
+        }
+        default:
+            throw Error("Unknown option --" + name);
+    }
+}
+
+void Options::validate() const
+{
+    if(numShards && (minPage != 0 || maxPage != LAST_PAGE))
+            throw Error("--shard cannot be combined with --min-page or --max-page");
+    if(numShards && !splitDir.empty()) throw Error("--shard cannot be combined with --split-output");
+    if(numShards && indexMode == INDEX_ONLY) throw Error("--shard cannot be combined with --index-only");
+    // --merge reads shards as plain json
+    if(numShards && compress) throw Error("--shard cannot be combined with --compress");
+}
+
+void Options::warn(const std::string &message) const
+{
+    if(warning) warning(message);
+    else std::cerr << message << std::endl;
+}
+
+std::string Options::describe() const
+{
+    std::ostringstream ret;
+    ret << "pages " << minPage << "-" << maxPage << " shard " << shardIndex << "/" << numShards
+            << " mode " << int(shardMode) << " split " << !splitDir.empty() << " index " << splitIndex << " "
+            << int(indexMode) << " keymapset " << keyMapSet << " dedupe " << dedupePages << " compress "
+            << (compress ? int(compressFormat) : -1);
+    return ret.str();
+}
+
+Converter::Converter(Inputs inputs, Options options) : in(std::move(inputs)), opts(std::move(options)),
+        layout(*in.layout), kleTemplate(*in.kleTemplate), settings(*in.settings), numReusedPages(0),
+        numRenderedPages(0)
+{
+    opts.validate();
+    keyMapSet = opts.keyMapSet.empty() ? settings.keyMapSet : opts.keyMapSet;
+    usedKeyMapSetId = layout.strings.find(keyMapSet.c_str());
+    if(std::none_of(layout.keyMapSets.begin(), layout.keyMapSets.end(),
+            [this](const CompiledKeyMapSet &set) {return set.id == usedKeyMapSetId;}))
+            throw Error("keyMapSet " + keyMapSet + " is not in the keylayout");
+    for(const StateSettings &state : settings.states)
+    {
+        stateIds.push_back(layout.strings.find(state.state.c_str()));
+        if(state.show) numShownStates++;
+    }
+    statePaths.resize(settings.states.size());
+    statePathComputed.resize(settings.states.size());
+}
+
+void Converter::reuseStatePaths(const Converter &previous)
+{
+    if(previous.in.layout != in.layout || previous.in.settings != in.settings
+            || previous.usedKeyMapSetId != usedKeyMapSetId) return;
+    statePaths = previous.statePaths;
+    statePathComputed = previous.statePathComputed;
+}
+
+// The layout ids the legends of a page are made of, following dead keys as renderPage does. The page's own state
+// is replaced by a marker so that aliased states get the same content.
+std::vector<uint32_t> Converter::pageContent(size_t iSettingsState) const
+{
+    const uint32_t SELF = StringArena::UNKNOWN - 1;
+    uint32_t stateId = stateIds[iSettingsState];
+    std::vector<uint32_t> ret;
+    for(const std::vector<KleCell> &row : kleTemplate.rows) for(const KleCell &cell : row)
+    {
+        if(cell.type != KleCell::LAYOUT_KEY) continue;
+        for(const LegendSettings &legend : settings.legends)
+        {
+            if(legend.mergeType != LegendSettings::NO) continue;
+            uint32_t c = stateId;
+            bool isDead = true;
+            for(uint8_t numDead = 0; isDead && numDead < 3; numDead++)
+            {
+                std::tie(c, isDead) = layout.keyOutput(usedKeyMapSetId, c, legend.index, cell.keyCode);
+                ret.push_back(c == stateId ? SELF : c);
+                ret.push_back(isDead);
+            }
+        }
+    }
+    return ret;
+}
+
+void Converter::assignPages()
+{
+    Profile::Scope scope(opts.profile, "page assignment");
+    Trace::Span span(opts.trace, "page assignment", "conversion");
+    pageStates.clear();
+    statePages.assign(settings.states.size(), 0);
+    // Pages by content hash, checked against the full content
+    std::unordered_map<uint64_t, std::vector<uint32_t>> pagesByHash;
+    std::vector<std::vector<uint32_t>> contents;
+    for(size_t i = 0; i < settings.states.size(); i++) if(settings.states[i].show)
+    {
+        if(opts.dedupePages)
+        {
+            std::vector<uint32_t> content = pageContent(i);
+            std::vector<uint32_t> &candidates = pagesByHash[fnv1a(content.data(), content.size() * sizeof(uint32_t))];
+            auto same = std::find_if(candidates.begin(), candidates.end(),
+                    [&](uint32_t page) {return contents[page] == content;});
+            if(same != candidates.end())
+            {
+                statePages[i] = *same + 1;
+                continue;
+            }
+            candidates.push_back(static_cast<uint32_t>(pageStates.size()));
+            contents.push_back(std::move(content));
+        }
+        pageStates.push_back(i);
+        statePages[i] = static_cast<uint32_t>(pageStates.size());
+    }
+}
+
+// Pages are numbered from 1. A shard's pages are laid out as in a single-process run so that the merged output
+// is identical to it.
+bool Converter::isPageRendered(uint32_t page) const
+{
+    if(opts.indexMode == Options::INDEX_ONLY) return false;
+    if(!opts.numShards) return page >= opts.minPage && page <= opts.maxPage;
+    if(opts.shardMode == Options::ROUND_ROBIN) return (page - 1) % opts.numShards == opts.shardIndex - 1;
+    return page > uint64_t(opts.shardIndex - 1) * pageStates.size() / opts.numShards
+            && page <= uint64_t(opts.shardIndex) * pageStates.size() / opts.numShards;
+}
+
+std::pair<uint32_t, bool> Converter::keyOutput(uint32_t state, uint16_t mapIndex, uint16_t keyCode,
+        std::vector<KeyQuery> *trace) const
+{
+    std::pair<uint32_t, bool> ret = layout.keyOutput(usedKeyMapSetId, state, mapIndex, keyCode);
+    if(PROBE_ENABLED(key_lookup))
+    {
+        PROBE5(key_lookup, layout.strings.str(state), mapIndex, keyCode, layout.strings.str(ret.first), ret.second);
+    }
+    if(trace) trace->push_back(KeyQuery{state, mapIndex, keyCode, ret.first, ret.second});
+    return ret;
+}
+
+std::string Converter::statePath2String(const std::vector<std::vector<KeyWithLevel>> &paths,
+        std::vector<KeyQuery> *trace) const
+{
+    std::string ret;
+    size_t minLength = SIZE_MAX;
+    std::unordered_set<std::string> displayedPaths; // To remove duplicates, strings with equal hashes included
+    Counters::add(&Counters::pathsBeforeFilter, paths.size());
+    for(const std::vector<KeyWithLevel>& vec : paths) minLength = std::min(minLength, vec.size());
+    for(const std::vector<KeyWithLevel>& vec : paths) if(vec.size() == minLength)
+    {
+        std::string pathStr;
+        const char *prevPrefix = "";
+        for(const KeyWithLevel& key : vec)
+        {
+            const char *prefix = settings.modifiers[key.mapIndex].prefix.c_str();
+            if(strcmp(prefix, prevPrefix))
+            {
+                if(!pathStr.empty()) pathStr += " ";
+                pathStr += settings.modifiers[key.mapIndex].prefix;
+            }
+            uint32_t outId;
+            bool isDead;
+            std::tie(outId, isDead) = keyOutput(layout.noneState, 0, key.keyCode, trace);
+            const char *outStr = layout.strings.str(outId);
+            if(isDead) pathStr += settings.stateLegend(outStr);
+            else
+            {
+                auto it = settings.substitutions.find(outStr);
+                if(it != settings.substitutions.end())
+                {
+                    Counters::add(&Counters::substitutionHits);
+                    pathStr += it->second;
+                }
+                else pathStr += outStr;
+            }
+            prevPrefix = prefix;
+        }
+        if(!displayedPaths.insert(pathStr).second) continue;
+        if(ret.size()) ret += " | ";
+        ret += pathStr;
+    }
+    return ret;
+}
+
+const std::string &Converter::statePath(size_t iSettingsState)
+{
+    if(!statePathComputed[iSettingsState])
+    {
+        std::vector<std::vector<KeyWithLevel>> paths;
+        {
+            Profile::Scope scope(opts.profile, "state paths");
+            Trace::Span span(opts.trace, "state path", "paths");
+            const std::string &stateName = settings.states[iSettingsState].state;
+            PROBE1(state_path_start, stateName.c_str());
+            uint8_t depth = 0;
+            for(; depth < 5; depth++)
+            {
+                paths = layout.findStatePath(usedKeyMapSetId, stateIds[iSettingsState], depth,
+                        settings.usedMapIndices);
+                if(!paths.empty()) break;
+            }
+            span.arg("state", stateName);
+            span.arg("depth", depth);
+            span.arg("paths", paths.size());
+            PROBE3(state_path_end, stateName.c_str(), depth, paths.size());
+        }
+        std::vector<KeyQuery> trace;
+        bool incremental = !opts.incrementalCache.empty();
+        statePaths[iSettingsState] = statePath2String(paths, incremental ? &trace : nullptr);
+        if(incremental) pathCache[iSettingsState] = {{"path", statePaths[iSettingsState]},
+                {"queries", queriesToJson(trace, iSettingsState)}};
+        statePathComputed[iSettingsState] = true;
+    }
+    return statePaths[iSettingsState];
+}
+
+// The paths of a batch of states are computed concurrently, each one by a single thread
+void Converter::computeStatePaths(const std::vector<size_t> &iSettingsStates)
+{
+    std::vector<size_t> missing;
+    for(size_t i : iSettingsStates) if(!statePathComputed[i]) missing.push_back(i);
+    std::atomic<size_t> next(0);
+    std::mutex failureMutex;
+    std::string failure;
+    auto worker = [&]()
+    {
+        ThreadCounters threadCounters(*this);
+        for(size_t i = next++; i < missing.size(); i = next++)
+        {
+            try
+            {
+                statePath(missing[i]);
+            }
+            catch(const Error &e)
+            {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                failure = e.what();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    size_t numThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), missing.size());
+    for(size_t i = 1; i < numThreads; i++) threads.emplace_back(worker);
+    worker();
+    for(std::thread &thread : threads) thread.join();
+    if(!failure.empty()) throw Error(failure);
+}
+
+nlohmann::json Converter::renderIndex()
+{
+    Profile::Scope scope(opts.profile, "index");
+    Trace::Span span(opts.trace, "index", "render");
+    nlohmann::json outRow = nlohmann::json::array();
+    std::vector<std::string> leftColumns, rightColumns;
+    uint32_t numRows = (numShownStates + settings.indexNumColumns - 1) / settings.indexNumColumns;
+    leftColumns.resize(settings.indexNumColumns);
+    rightColumns.resize(settings.indexNumColumns);
+    // Only the index needs every path, it is only rendered when it is written
+    std::vector<size_t> shownStates;
+    for(size_t i = 0; i < settings.states.size(); i++) if(settings.states[i].show) shownStates.push_back(i);
+    computeStatePaths(shownStates);
+    uint32_t iState = 0;
+    for(size_t i = 0; i < settings.states.size(); i++) if(settings.states[i].show)
+    {
+        const StateSettings &state = settings.states[i];
+        size_t column = uint64_t(iState) * settings.indexNumColumns / numShownStates;
+        leftColumns[column] += "<p class=\"indexLeft\"><span class=\"legend\">" + state.legend
+                + "</span><span class=\"stateName\">" + state.display + "</span></p>";
+        rightColumns[column] += "<p class=\"indexRight\"><span class=\"path\">"
+                + statePath(i)
+                + "</span><span class=\"pageNumber\">" + std::to_string(statePages[i]) + "</span></p>";
+        iState++;
+    }
+    for(uint16_t i = 0; i < settings.indexNumColumns; i++)
+    {
+        outRow[i * 2]["h"] = numRows * 0.25f;
+        outRow[i * 2]["w"] = settings.indexWidth;
+        outRow[i * 2]["d"] = true;
+        outRow[i * 2 + 1] = leftColumns[i] + "\n\n" + rightColumns[i];
+    }
+    return outRow;
+}
+
+// Renders the rows of a state's page. The first page of an output is offset by the index height, the next ones by
+// stateDy. It only reads shared data, so pages can be rendered concurrently.
+void Converter::renderPage(size_t iSettingsState, uint32_t iState, bool isFirstPage, float firstPageDy,
+        nlohmann::json &pageJson, PageTrace *trace)
+{
+    std::vector<KeyQuery> *queries = trace ? &trace->queries : nullptr;
+    const StateSettings &state = settings.states[iSettingsState];
+    uint32_t stateId = stateIds[iSettingsState];
+    const std::vector<LegendSettings> &legendSettings = settings.legends;
+    size_t numMaps = legendSettings.size();
+    uint16_t numLegends = settings.numLegends;
+    std::vector<std::string> legends, colors;
+    legends.reserve(numLegends);
+    colors.reserve(numLegends);
+    LegendDecorator decorator(settings);
+    // Keys are too many for a span each, the page span gives the time of their ICU decoration
+    Profile::Accumulator pageTime(opts.profile != nullptr), icuTime(opts.profile != nullptr || opts.trace != nullptr);
+    pageTime.start();
+    Trace::Span span(opts.trace, "page", "render");
+    span.arg("page", iState + 1);
+    span.arg("state", state.state);
+    PROBE2(page_start, iState + 1, state.state.c_str());
+    bool firstRow = true;
+    for(const std::vector<KleCell> &row : kleTemplate.rows)
+    {
+        nlohmann::json outRow = nlohmann::json::array();
+        nlohmann::json keyProperties;
+        bool firstElem = true;
+        for(const KleCell &cell : row)
+        {
+            keyProperties = cell.properties;
+            std::string str = cell.text;
+            if(cell.type != KleCell::TEXT)
+            {
+                // Labels based on layout
+                if(cell.type == KleCell::LAYOUT_KEY)
+                {
+                    legends = cell.legends;
+                    legends.resize(numLegends);
+                    colors.clear();
+                    colors.resize(numLegends);
+                    uint16_t keyNumLegends = 0;
+                    uint16_t keyNumColors = 0;
+
+                    for(size_t i = 0; i < numMaps; i++)
+                    {
+                        switch(legendSettings[i].mergeType)
+                        {
+                            case LegendSettings::NO:
+                            {
+                                uint32_t c;
+                                bool isDead;
+                                std::tie(c, isDead) = keyOutput(stateId, legendSettings[i].index, cell.keyCode,
+                                        queries);
+                                if(c != StringArena::NONE && (!isDead || c != stateId))
+                                {
+                                    keyNumLegends = std::max<uint16_t>(keyNumLegends, legendSettings[i].place + 1);
+                                    if(isDead)
+                                    {
+                                        // Check if it produces other dead keys when pressed multiple times.
+                                        // The legend shows chains and loops.
+                                        uint32_t deadKeyChain[3];
+                                        deadKeyChain[0] = c;
+                                        uint8_t numDead = 1;
+                                        while(numDead < 3)
+                                        {
+                                            std::tie(c, isDead) = keyOutput(c, legendSettings[i].index,
+                                                    cell.keyCode, queries);
+                                            if(isDead) deadKeyChain[numDead++] = c;
+                                            else break;
+                                        }
+                                        Counters::addDeadKeyChain(numDead);
+                                        std::string &legend = legends[legendSettings[i].place];
+                                        bool zeroIs2 = false;
+                                        bool currentIs1 = false;
+                                        if(numDead > 2)
+                                        {
+                                            zeroIs2 = deadKeyChain[0] == deadKeyChain[2];
+                                            currentIs1 = stateId == deadKeyChain[1];
+                                            if(zeroIs2 && !currentIs1)
+                                                    legend += "<span class=\"nongraphic\">|</span>";
+
+                                        }
+                                        auto deadKeyLegend = [this](uint32_t deadKey)
+                                        {
+                                            return settings.stateLegend(layout.strings.str(deadKey));
+                                        };
+                                        legend += "<span class=\"deadkey\">" + deadKeyLegend(deadKeyChain[0])
+                                                + "</span>";
+                                        if(numDead >= 2)
+                                        {
+                                            if(deadKeyChain[1] == stateId || deadKeyChain[1] == deadKeyChain[0])
+                                                    legend += "<span class=\"nongraphic\">|</span>";
+                                            else
+                                            {
+                                                legend += "<span class=\"deadkey2\">"
+                                                        + deadKeyLegend(deadKeyChain[1]) + "</span>";
+                                                if(numDead >= 3)
+                                                {
+                                                    if(stateId == deadKeyChain[2] || zeroIs2)
+                                                            legend += "<span class=\"nongraphic\">|</span>";
+                                                    else legend += "<span class=\"nongraphic\">·</span>";
+                                                }
+                                            }
+                                        }
+                                    }
+                                    else legends[legendSettings[i].place] = std::string(layout.strings.str(c));
+                                    const std::string &color = legendSettings[i].color;
+                                    if(!color.empty())
+                                    {
+                                        keyNumColors = std::max<uint16_t>(keyNumColors, legendSettings[i].place + 1);
+                                        colors[legendSettings[i].place] = color;
+                                    }
+                                }
+                                break;
+                            }
+                            default:
+                            {
+                                if(!legendSettings[i].merges(legends[legendSettings[i].merge[0]],
+                                        legends[legendSettings[i].merge[1]])) break;
+                                keyNumLegends = std::max<uint16_t>(keyNumLegends, legendSettings[i].place + 1);
+                                legends[legendSettings[i].place] = std::move(legends[legendSettings[i].merge[0]]);
+                                legends[legendSettings[i].merge[0]].clear();
+                                legends[legendSettings[i].merge[1]].clear();
+                                const std::string &color = legendSettings[i].color;
+                                if(!color.empty())
+                                {
+                                    keyNumColors = std::max<uint16_t>(keyNumColors, legendSettings[i].place + 1);
+                                    colors[legendSettings[i].place] = color;
+                                }
+                                break;
+                            }
+                        }
+                    }
+                    str = "";
+                    for(uint16_t iLegend = 0; iLegend < keyNumLegends; iLegend++)
+                    {
+                        if(settings.placesUsed[iLegend])
+                        {
+                            icuTime.start();
+                            UChar32 c32 = decorator.decorate(legends[iLegend], str);
+                            if(c32 != U_SENTINEL)
+                            {
+                                std::lock_guard<std::mutex> lock(nonGraphicsMutex);
+                                if(nonGraphics.find(c32) == nonGraphics.end())
+                                {
+                                    UErrorCode error = U_ZERO_ERROR;
+                                    char charName[256];
+                                    u_charName(c32, U_UNICODE_CHAR_NAME, charName, 256, &error);
+                                    std::ostringstream message;
+                                    message << "Warning: character " << std::hex << c32 << std::dec << " "
+                                            << charName << " is non-graphic.";
+                                    if(nonGraphics.empty()) message << " Substitute this character to remove "
+                                            "this warning.";
+                                    opts.warn(message.str());
+                                    nonGraphics.insert(c32);
+                                }
+                            }
+                            icuTime.stop();
+                        }
+                        else str += legends[iLegend];
+                        str += '\n';
+                    }
+                    if(keyNumColors)
+                    {
+                        std::string colorStr;
+                        for(uint16_t iColor = 0; iColor < keyNumColors; iColor++)
+                        {
+                            colorStr += colors[iColor];
+                            colorStr += "\n";
+                        }
+                        keyProperties["t"] = colorStr;
+                    }
+                }
+            }
+            else
+            {
+                // Find variables to replace
+                for(size_t pos = str.find('$'); pos != std::string::npos; pos = str.find('$', ++pos))
+                {
+                    StrHash64 hash;
+                    size_t end = pos + 1;
+                    while(str[end] >= 'A' && str[end] <= 'Z')
+                    {
+                        hash.hashCharacter(str[end]);
+                        end++;
+                    }
+                    bool replace = false;
+                    std::string replaceString;
+                    switch(hash)
+                    {
+                        case "PAGE"_hash64:
+                            replace = true;
+                            replaceString = std::to_string(iState + 1);
+                            break;
+                        case "PATH"_hash64:
+                            replace = true;
+                            replaceString = statePath(iSettingsState);
+                            if(trace) trace->usesPath = true;
+                            break;
+                        case "LEGEND"_hash64:
+                            replace = true;
+                            replaceString = settings.stateLegend(state.state);
+                            break;
+                        case "STATE"_hash64:
+                            replace = true;
+                            replaceString = state.display;
+                            break;
+                    }
+                    if(replace) str.replace(pos, end - pos, replaceString);
+                }
+            }
+
+            if(firstElem && firstRow)
+            {
+                if(!isFirstPage)
+                {
+                    keyProperties["y"] = settings.stateDy;
+                    if(!keyProperties.contains("a")) keyProperties["a"] = 4;
+                    if(!keyProperties.contains("t")) keyProperties["t"] = "#000000";
+                }
+                else keyProperties["y"] = firstPageDy;
+            }
+            if(keyProperties.type() != nlohmann::json::value_t::null) outRow.push_back(keyProperties);
+            keyProperties = nlohmann::json();
+            outRow.push_back(str);
+            firstElem = false;
+        }
+        pageJson.push_back(outRow);
+        firstRow = false;
+    }
+    pageTime.stop();
+    span.arg("icuDecorationMs", icuTime.time().wall);
+    PROBE2(page_end, iState + 1, state.state.c_str());
+    if(opts.profile)
+    {
+        opts.profile->add("ICU decoration", icuTime.time());
+        opts.profile->add("pages", pageTime.time());
+        opts.profile->addPage(iState + 1, state.state, pageTime.time());
+    }
+}
+
+// Incremental cache. A page is reused if it was rendered with the same settings, KLE keyboard and position, and if
+// all the keyOutput calls it made give the same results with the current layout. Its state path must also be the
+// same if it shows it. A state path is reused if the transitions are the same and its keyOutput calls hold.
+static const int INCREMENTAL_CACHE_VERSION = 1;
+
+void Converter::renderPageIncremental(size_t iSettingsState, uint32_t iState, bool isFirstPage, float firstPageDy,
+        nlohmann::json &pageJson)
+{
+    if(opts.incrementalCache.empty())
+    {
+        renderPage(iSettingsState, iState, isFirstPage, firstPageDy, pageJson, nullptr);
+        numRenderedPages++;
+        return;
+    }
+    // The offset only matters on the first page
+    float dy = isFirstPage ? firstPageDy : 0.f;
+    const nlohmann::json &entry = pageCache[iSettingsState];
+    if(entry.type() == nlohmann::json::value_t::object && entry.at("page") == iState
+            && entry.at("firstPage") == isFirstPage && entry.at("dy").get<float>() == dy
+            && (!entry.at("usesPath").get<bool>() || entry.at("path") == statePath(iSettingsState))
+            && queriesHold(entry.at("queries")))
+    {
+        for(const nlohmann::json &row : entry.at("rows")) pageJson.push_back(row);
+        numReusedPages++;
+        return;
+    }
+    PageTrace trace;
+    nlohmann::json rows = nlohmann::json::array();
+    renderPage(iSettingsState, iState, isFirstPage, firstPageDy, rows, &trace);
+    for(const nlohmann::json &row : rows) pageJson.push_back(row);
+    nlohmann::json newEntry = {{"page", iState}, {"firstPage", isFirstPage}, {"dy", dy},
+            {"usesPath", trace.usesPath}, {"queries", queriesToJson(trace.queries, iSettingsState)},
+            {"rows", std::move(rows)}};
+    if(trace.usesPath) newEntry["path"] = statePath(iSettingsState);
+    pageCache[iSettingsState] = std::move(newEntry);
+    numRenderedPages++;
+}
+
+// Queries are stored with strings, ids are not stable between layouts. [state, mapIndex, keyCode, result, isDead]
+nlohmann::json Converter::queriesToJson(const std::vector<KeyQuery> &queries, size_t iSettingsState) const
+{
+    nlohmann::json ret = nlohmann::json::array();
+    for(const KeyQuery &query : queries)
+    {
+        // Only the page's own state can be missing from the layout
+        const char *state = layout.strings.str(query.state);
+        const char *result = layout.strings.str(query.result);
+        ret.push_back({state ? state : settings.states[iSettingsState].state.c_str(), query.mapIndex,
+                query.keyCode, result ? nlohmann::json(result) : nlohmann::json(), query.isDead});
+    }
+    return ret;
+}
+
+bool Converter::queriesHold(const nlohmann::json &queries) const
+{
+    for(const nlohmann::json &query : queries)
+    {
+        uint32_t state = layout.strings.find(query.at(0).get_ref<const std::string&>().c_str());
+        uint32_t result;
+        bool isDead;
+        std::tie(result, isDead) = layout.keyOutput(usedKeyMapSetId, state, query.at(1).get<uint16_t>(),
+                query.at(2).get<uint16_t>());
+        if(isDead != query.at(4).get<bool>()) return false;
+        const char *resultStr = layout.strings.str(result);
+        if(query.at(3).type() == nlohmann::json::value_t::null ? resultStr != nullptr
+                : !resultStr || query.at(3).get_ref<const std::string&>() != resultStr) return false;
+    }
+    return true;
+}
+
+void Converter::loadIncrementalCache()
+{
+    Profile::Scope scope(opts.profile, "incremental cache load");
+    Trace::Span span(opts.trace, "incremental cache load", "cache");
+    pageCache.assign(settings.states.size(), nlohmann::json());
+    pathCache.assign(settings.states.size(), nlohmann::json());
+    transitionHash = layout.transitionHash();
+    nlohmann::json cache;
+    try
+    {
+        cache = nlohmann::json::parse(Source::file(opts.incrementalCache).read());
+    }
+    catch(const std::exception &e)
+    {
+        // First run, or a cache from an incompatible version
+        return;
+    }
+    try
+    {
+        if(cache.at("version") != INCREMENTAL_CACHE_VERSION || cache.at("kle") != kleTemplate.contentHash
+                || cache.at("settings") != settings.contentHash || cache.at("keyMapSet") != keyMapSet
+                || cache.at("pages").size() != settings.states.size()) return;
+        for(size_t i = 0; i < settings.states.size(); i++) pageCache[i] = std::move(cache.at("pages").at(i));
+        if(cache.at("transitions") != transitionHash) return;
+        for(size_t i = 0; i < settings.states.size(); i++)
+        {
+            nlohmann::json &entry = cache.at("paths").at(i);
+            if(entry.type() != nlohmann::json::value_t::object || !queriesHold(entry.at("queries"))) continue;
+            statePaths[i] = entry.at("path").get<std::string>();
+            statePathComputed[i] = true;
+            pathCache[i] = std::move(entry);
+        }
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        opts.warn(opts.incrementalCache + " is invalid, it is ignored");
+        pageCache.assign(settings.states.size(), nlohmann::json());
+        pathCache.assign(settings.states.size(), nlohmann::json());
+    }
+}
+
+// Pages that were not rendered by this run are kept, they are checked when used
+void Converter::saveIncrementalCache() const
+{
+    Profile::Scope scope(opts.profile, "incremental cache save");
+    Trace::Span span(opts.trace, "incremental cache save", "cache");
+    nlohmann::json cache = {{"version", INCREMENTAL_CACHE_VERSION}, {"kle", kleTemplate.contentHash},
+            {"settings", settings.contentHash}, {"keyMapSet", keyMapSet}, {"transitions", transitionHash},
+            {"pages", pageCache}, {"paths", pathCache}};
+    std::string tmpPath = opts.incrementalCache + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary);
+    file << cache << std::endl;
+    file.close();
+    if(file.fail() || rename(tmpPath.c_str(), opts.incrementalCache.c_str()))
+            throw Error("Cannot write " + opts.incrementalCache);
+}
+
+void Converter::convert(std::ostream &out)
+{
+    Profile::Scope scope(opts.profile, "conversion");
+    Trace::Span span(opts.trace, "conversion", "conversion");
+    {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        counters = Counters();
+    }
+    ThreadCounters threadCounters(*this);
+    numReusedPages = 0;
+    numRenderedPages = 0;
+    if(!opts.incrementalCache.empty()) loadIncrementalCache();
+    assignPages();
+    bool hasIndex = settings.hasIndex && opts.indexMode != Options::NO_INDEX;
+    if(opts.indexMode == Options::INDEX_ONLY && !settings.hasIndex)
+            throw Error("--index-only: the settings do not have an index");
+    bool renderIndexRow = hasIndex && (opts.indexMode == Options::INDEX_ONLY
+            || (opts.numShards ? opts.shardIndex == 1 : opts.minPage == 0));
+    uint32_t firstPage = opts.numShards ? 1 : std::max<uint32_t>(opts.minPage, 1);
+    nlohmann::json outJson = nlohmann::json::array();
+    nlohmann::json shardJson;
+    if(opts.numShards)
+    {
+        shardJson["header"] = kleTemplate.header;
+        shardJson["numPages"] = pageStates.size();
+        shardJson["pages"] = nlohmann::json::array();
+    }
+    else outJson.push_back(kleTemplate.header);
+
+    // Index
+    float firstStateDy = 0.f;
+    if(hasIndex && (renderIndexRow || opts.numShards))
+    {
+        uint32_t numRows = (numShownStates + settings.indexNumColumns - 1) / settings.indexNumColumns;
+        firstStateDy = numRows * 0.25f;
+    }
+    if(renderIndexRow)
+    {
+        if(opts.numShards) shardJson["index"] = renderIndex();
+        else outJson.push_back(renderIndex());
+    }
+
+    // Outputs are compressed as they are written
+    std::string fileExtension = opts.compress
+            ? std::string(".json") + CompressedStreamBuf::extension(opts.compressFormat) : ".json";
+    bool compress = opts.compress;
+    CompressedStreamBuf::Format compressFormat = opts.compressFormat;
+    Profile *profile = opts.profile;
+    Trace *trace = opts.trace;
+    auto writeFile = [compress, compressFormat, profile, trace](const std::string &path, const nlohmann::json &json)
+    {
+        Profile::Scope scope(profile, "output");
+        Trace::Span span(trace, "output", "output");
+        span.arg("file", path);
+        std::ofstream file(path, std::ios::binary);
+        if(compress)
+        {
+            CompressedStreamBuf compressedBuf(file.rdbuf(), compressFormat);
+            std::ostream compressedStream(&compressedBuf);
+            compressedStream << json << std::endl;
+            if(!compressedBuf.finish() || !compressedStream) return false;
+        }
+        else file << json << std::endl;
+        file.close();
+        return !file.fail();
+    };
+
+    if(!opts.splitDir.empty())
+    {
+        // Each page is a standalone keyboard, written by a pool of threads
+        const std::string &splitDir = opts.splitDir;
+        if(!makeDirectory(splitDir)) throw Error("Cannot create directory " + splitDir);
+        nlohmann::json manifest;
+        if(renderIndexRow)
+        {
+            if(!writeFile(splitDir + "/index" + fileExtension, outJson))
+                    throw Error("Cannot write " + splitDir + "/index" + fileExtension);
+            manifest["index"] = "index" + fileExtension;
+        }
+        std::vector<std::pair<size_t, uint32_t>> pages;
+        for(uint32_t iPage = 0; iPage < pageStates.size(); iPage++)
+                if(isPageRendered(iPage + 1)) pages.push_back(std::make_pair(pageStates[iPage], iPage));
+        auto pageFileName = [&fileExtension](uint32_t iState)
+        {
+            char name[24];
+            snprintf(name, sizeof(name), "page_%03lu", static_cast<unsigned long>(iState) + 1);
+            return name + fileExtension;
+        };
+        std::atomic<size_t> nextPage(0);
+        std::mutex failureMutex;
+        std::string failure;
+        auto worker = [&]()
+        {
+            ThreadCounters threadCounters(*this);
+            for(size_t i = nextPage++; i < pages.size(); i = nextPage++)
+            {
+                uint32_t iState = pages[i].second;
+                nlohmann::json pageJson = opts.splitIndex ? outJson : nlohmann::json::array({kleTemplate.header});
+                try
+                {
+                    statePath(pages[i].first);
+                    renderPageIncremental(pages[i].first, iState, true, opts.splitIndex ? firstStateDy : 0.f,
+                            pageJson);
+                }
+                catch(const Error &e)
+                {
+                    std::lock_guard<std::mutex> lock(failureMutex);
+                    failure = e.what();
+                    continue;
+                }
+                std::string path = splitDir + "/" + pageFileName(iState);
+                if(!writeFile(path, pageJson))
+                {
+                    std::lock_guard<std::mutex> lock(failureMutex);
+                    failure = "Cannot write " + path;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        size_t numThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), pages.size());
+        for(size_t i = 1; i < numThreads; i++) threads.emplace_back(worker);
+        worker();
+        for(std::thread &thread : threads) thread.join();
+        if(!failure.empty()) throw Error(failure);
+        manifest["pages"] = nlohmann::json::array();
+        // States rendered on the page of another one
+        std::vector<std::vector<std::string>> aliases(pageStates.size());
+        for(size_t i = 0; i < settings.states.size(); i++) if(statePages[i] && pageStates[statePages[i] - 1] != i)
+                aliases[statePages[i] - 1].push_back(settings.states[i].state);
+        for(const std::pair<size_t, uint32_t> &page : pages)
+        {
+            const StateSettings &state = settings.states[page.first];
+            manifest["pages"].push_back({{"page", page.second + 1}, {"file", pageFileName(page.second)},
+                    {"state", state.state}, {"display", state.display}, {"legend", state.legend},
+                    {"path", statePath(page.first)}});
+            if(!aliases[page.second].empty()) manifest["pages"].back()["aliases"] = std::move(aliases[page.second]);
+        }
+        std::ofstream manifestFile(splitDir + "/manifest.json");
+        manifestFile << manifest.dump(4) << std::endl;
+        if(!manifestFile) throw Error("Cannot write " + splitDir + "/manifest.json");
+        if(!opts.incrementalCache.empty()) saveIncrementalCache();
+        return;
+    }
+
+    std::unique_ptr<CompressedStreamBuf> compressedOut;
+    if(compress) compressedOut.reset(new CompressedStreamBuf(out.rdbuf(), compressFormat));
+    std::ostream stream(compress ? compressedOut.get() : out.rdbuf());
+    // Pages are written as soon as they are rendered, the output is never held in memory as a whole
+    Profile::Accumulator outputTime(opts.profile != nullptr);
+    {
+        Trace::Span outputSpan(opts.trace, "output", "output");
+        outputTime.start();
+        if(!opts.numShards) for(size_t i = 0; i < outJson.size(); i++) stream << (i ? ',' : '[') << outJson[i];
+        outputTime.stop();
+    }
+    for(uint32_t iPage = 0; iPage < pageStates.size(); iPage++)
+    {
+        if(!isPageRendered(iPage + 1)) continue;
+        if(opts.numShards)
+        {
+            shardJson["pages"].push_back({{"page", iPage + 1}, {"rows", nlohmann::json::array()}});
+            renderPageIncremental(pageStates[iPage], iPage, iPage + 1 <= firstPage, firstStateDy,
+                    shardJson["pages"].back()["rows"]);
+        }
+        else
+        {
+            nlohmann::json pageJson = nlohmann::json::array();
+            renderPageIncremental(pageStates[iPage], iPage, iPage + 1 <= firstPage, firstStateDy, pageJson);
+            Trace::Span outputSpan(opts.trace, "output", "output");
+            outputTime.start();
+            for(const nlohmann::json &row : pageJson) stream << ',' << row;
+            outputTime.stop();
+        }
+    }
+    {
+        Trace::Span outputSpan(opts.trace, "output", "output");
+        outputTime.start();
+        if(opts.numShards) stream << shardJson << std::endl;
+        else stream << ']' << std::endl;
+        if(compressedOut && !compressedOut->finish()) throw Error("Cannot write the compressed output");
+        outputTime.stop();
+    }
+    if(opts.profile) opts.profile->add("output", outputTime.time());
+    if(!stream || !out) throw Error("Cannot write the output");
+    if(!opts.incrementalCache.empty()) saveIncrementalCache();
+}
+
+// The map set is inserted before the extensions of the file name
+static std::string keyMapSetFile(const std::string &path, const std::string &keyMapSet)
+{
+    size_t nameStart = path.find_last_of('/');
+    size_t dot = path.find('.', nameStart == std::string::npos ? 0 : nameStart + 1);
+    if(dot == std::string::npos) return path + "." + keyMapSet;
+    return path.substr(0, dot) + "." + keyMapSet + path.substr(dot);
+}
+
+void convertKeyMapSets(const Inputs &inputs, const Options &options, const std::vector<std::string> &keyMapSets,
+        const std::string &output)
+{
+    if(output.empty() && options.splitDir.empty()) throw Error("Several keyMapSets need an output file or directory");
+    if(!options.splitDir.empty() && !makeDirectory(options.splitDir))
+            throw Error("Cannot create directory " + options.splitDir);
+    // The compiled layout is shared, each converter has its own state paths
+    std::vector<std::future<void>> futures;
+    for(const std::string &keyMapSet : keyMapSets)
+    {
+        Options setOptions = options;
+        setOptions.keyMapSet = keyMapSet;
+        if(!options.splitDir.empty()) setOptions.splitDir = options.splitDir + "/" + keyMapSet;
+        if(!options.incrementalCache.empty())
+                setOptions.incrementalCache = keyMapSetFile(options.incrementalCache, keyMapSet);
+        std::string setOutput = output.empty() ? output : keyMapSetFile(output, keyMapSet);
+        futures.push_back(std::async(std::launch::async, [&inputs, setOptions, setOutput]()
+        {
+            Converter converter(inputs, setOptions);
+            if(setOutput.empty())
+            {
+                std::ostringstream unused;
+                converter.convert(unused);
+                return;
+            }
+            std::ofstream file(setOutput, std::ios::binary);
+            if(!file) throw Error("Cannot open " + setOutput);
+            converter.convert(file);
+            file.close();
+            if(file.fail()) throw Error("Cannot write " + setOutput);
+        }));
+    }
+    // Wait for all of them before reporting the first failure
+    std::string failure;
+    for(std::future<void> &future : futures)
+    {
+        try
+        {
+            future.get();
+        }
+        catch(const Error &e)
+        {
+            if(failure.empty()) failure = e.what();
+        }
+    }
+    if(!failure.empty()) throw Error(failure);
+}
+
+// Shard outputs are objects with the header, the index row if the shard has it, and the rows of each of its pages.
+// They are put back together in the order of a single-process run.
+void mergeShards(const std::vector<std::string> &files, std::ostream &out)
+{
+    nlohmann::json header, index;
+    std::vector<nlohmann::json> pages;
+    bool hasHeader = false;
+    for(const std::string &fileName : files)
+    {
+        nlohmann::json shard;
+        try
+        {
+            shard = nlohmann::json::parse(Source::file(fileName).read());
+        }
+        catch(const nlohmann::json::exception &e)
+        {
+            throw Error(fileName + ": " + e.what());
+        }
+        if(!shard.contains("header") || !shard.contains("numPages") || !shard.contains("pages"))
+                throw Error(fileName + " is not a shard output");
+        size_t numPages = shard.at("numPages").get<size_t>();
+        if(!hasHeader)
+        {
+            header = std::move(shard.at("header"));
+            pages.resize(numPages);
+            hasHeader = true;
+        }
+        else if(numPages != pages.size()) throw Error(fileName + ": shards have different page counts");
+        if(shard.contains("index")) index = std::move(shard.at("index"));
+        for(nlohmann::json &page : shard.at("pages"))
+        {
+            size_t pageNumber = page.at("page").get<size_t>();
+            if(pageNumber < 1 || pageNumber > numPages || pages[pageNumber - 1].type() != nlohmann::json::value_t::null)
+                    throw Error(fileName + ": unexpected page " + std::to_string(pageNumber));
+            pages[pageNumber - 1] = std::move(page.at("rows"));
+        }
+    }
+    nlohmann::json outJson = nlohmann::json::array();
+    outJson.push_back(std::move(header));
+    if(index.type() != nlohmann::json::value_t::null) outJson.push_back(std::move(index));
+    for(size_t i = 0; i < pages.size(); i++)
+    {
+        if(pages[i].type() == nlohmann::json::value_t::null)
+                throw Error("Page " + std::to_string(i + 1) + " is missing");
+        for(nlohmann::json &row : pages[i]) outJson.push_back(std::move(row));
+    }
+    out << outJson << std::endl;
+}
+
+}
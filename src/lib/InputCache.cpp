@@ -0,0 +1,117 @@
+#include "Hash128.hpp"
+#include "InputCache.hpp"
+
+namespace keylayout2kle
+{
+
+template<typename T> template<typename Loader> std::shared_ptr<const T> InputCache::Table<T>::get(
+        const std::string &content, Loader load, Stats &stats, std::mutex &statsMutex)
+{
+    Hash128 hash = Hash128::make(content);
+    Key key(hash.low, hash.high);
+    std::promise<std::shared_ptr<const T>> promise;
+    std::shared_future<std::shared_ptr<const T>> future;
+    bool isLoader = false;
+    uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if(it == entries.end())
+        {
+            // Drop the least recently used entry. Pending loads keep their future alive for their waiters.
+            if(entries.size() >= maxEntries)
+            {
+                auto oldest = entries.begin();
+                for(auto e = entries.begin(); e != entries.end(); ++e) if(e->second.lastUse < oldest->second.lastUse)
+                        oldest = e;
+                entries.erase(oldest);
+            }
+            future = promise.get_future().share();
+            generation = ++useCount;
+            entries.emplace(key, Entry{future, content, generation, generation});
+            isLoader = true;
+        }
+        else if(it->second.content != content)
+        {
+            // Another content with the same hash: load it without caching it
+            isLoader = true;
+            future = promise.get_future().share();
+        }
+        else
+        {
+            it->second.lastUse = ++useCount;
+            future = it->second.value;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if(isLoader) stats.misses++;
+        else stats.hits++;
+    }
+    if(isLoader)
+    {
+        try
+        {
+            promise.set_value(load(Source::memory(content)));
+        }
+        catch(...)
+        {
+            // Failed loads are not cached
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key);
+            if(it != entries.end() && it->second.generation == generation) entries.erase(it);
+        }
+    }
+    return future.get();
+}
+
+std::shared_ptr<const CompiledLayout> InputCache::layout(const Source &source)
+{
+    return layouts.get(source.read(), [](const Source &source)
+    {
+        return CompiledLayout::load(source);
+    }, cacheStats, statsMutex);
+}
+
+std::shared_ptr<const KleTemplate> InputCache::kleTemplate(const Source &source)
+{
+    return kleTemplates.get(source.read(), [](const Source &source)
+    {
+        return KleTemplate::load(source);
+    }, cacheStats, statsMutex);
+}
+
+std::shared_ptr<const Settings> InputCache::settings(const Source &source)
+{
+    return settingsCache.get(source.read(), [](const Source &source)
+    {
+        return Settings::load(source);
+    }, cacheStats, statsMutex);
+}
+
+Inputs InputCache::inputs(const Source &keylayout, const Source &kle, const Source &settingsSource)
+{
+    Inputs inputs;
+    std::future<std::shared_ptr<const CompiledLayout>> layoutFuture = std::async(std::launch::async,
+            [this, &keylayout]()
+    {
+        return layout(keylayout);
+    });
+    std::future<std::shared_ptr<const KleTemplate>> kleFuture = std::async(std::launch::async, [this, &kle]()
+    {
+        return kleTemplate(kle);
+    });
+    inputs.settings = settings(settingsSource);
+    inputs.layout = layoutFuture.get();
+    inputs.kleTemplate = kleFuture.get();
+    return inputs;
+}
+
+InputCache::Stats InputCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return cacheStats;
+}
+
+}
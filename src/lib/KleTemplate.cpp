@@ -0,0 +1,149 @@
+#include <unordered_map>
+#include "KleTemplate.hpp"
+
+namespace keylayout2kle
+{
+
+namespace
+{
+    // Keycodes of ISO keyboards, strings based on UK QWERTY
+    const std::unordered_map<std::string, uint16_t> name2Keycode =
+    {
+        {"#`",     0x0A},
+        {"#1",     0x12},
+        {"#2",     0x13},
+        {"#3",     0x14},
+        {"#4",     0x15},
+        {"#5",     0x17},
+        {"#6",     0x16},
+        {"#7",     0x1A},
+        {"#8",     0x1C},
+        {"#9",     0x19},
+        {"#0",     0x1D},
+        {"#-",     0x1B},
+        {"#=",     0x18},
+        {"#Q",     0x0C},
+        {"#W",     0x0D},
+        {"#E",     0x0E},
+        {"#R",     0x0F},
+        {"#T",     0x11},
+        {"#Y",     0x10},
+        {"#U",     0x20},
+        {"#I",     0x22},
+        {"#O",     0x1F},
+        {"#P",     0x23},
+        {"#[",     0x21},
+        {"#]",     0x1E},
+        {"#A",     0x00},
+        {"#S",     0x01},
+        {"#D",     0x02},
+        {"#F",     0x03},
+        {"#G",     0x05},
+        {"#H",     0x04},
+        {"#J",     0x26},
+        {"#K",     0x28},
+        {"#L",     0x25},
+        {"#;",     0x29},
+        {"#'",     0x27},
+        {"##",     0x2A},
+        {"#B/",    0x32},
+        {"#Z",     0x06},
+        {"#X",     0x07},
+        {"#C",     0x08},
+        {"#V",     0x09},
+        {"#B",     0x0B},
+        {"#N",     0x2D},
+        {"#M",     0x2E},
+        {"#,",     0x2B},
+        {"#.",     0x2F},
+        {"#/",     0x2C},
+        {"#SPACE", 0x31}
+    };
+}
+
+std::shared_ptr<const KleTemplate> KleTemplate::load(const Source &source, Timing *parseTime, Timing *templateTime)
+{
+    nlohmann::json kleKeyboard;
+    Stopwatch stopwatch;
+    std::string content = source.read();
+    try
+    {
+        kleKeyboard = nlohmann::json::parse(content);
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        throw Error(std::string("KLE parse fail: ") + e.what());
+    }
+    if(parseTime) *parseTime = stopwatch.elapsed();
+    stopwatch = Stopwatch();
+    std::shared_ptr<KleTemplate> ret;
+    try
+    {
+        ret = std::make_shared<KleTemplate>(kleKeyboard);
+        ret->contentHash = fnv1a(content.data(), content.size());
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        throw Error(std::string("Invalid KLE keyboard: ") + e.what());
+    }
+    if(templateTime) *templateTime = stopwatch.elapsed();
+    return ret;
+}
+
+KleTemplate::KleTemplate(const nlohmann::json &kleKeyboard)
+{
+    if(kleKeyboard.type() != nlohmann::json::value_t::array || kleKeyboard.empty())
+            throw Error("The KLE keyboard is not a non-empty array");
+    // First row isn't keycaps. It's output once.
+    header = kleKeyboard[0];
+    for(const nlohmann::json &row : kleKeyboard)
+    {
+        if(row.type() != nlohmann::json::value_t::array) continue;
+        rows.emplace_back();
+        std::vector<KleCell> &cells = rows.back();
+        nlohmann::json keyProperties;
+        for(const nlohmann::json &elem : row)
+        {
+            if(elem.type() == nlohmann::json::value_t::object)
+            {
+                keyProperties = elem;
+                continue;
+            }
+            cells.emplace_back();
+            KleCell &cell = cells.back();
+            cell.properties = std::move(keyProperties);
+            keyProperties = nlohmann::json();
+            cell.text = elem.get<std::string>();
+            cell.type = KleCell::TEXT;
+            if(cell.text[0] == '#')
+            {
+                // All the lines are kept, the converter only uses as many as the settings have legends
+                size_t strPos = -1;
+                do
+                {
+                    strPos++;
+                    size_t newStrPos = cell.text.find("\n", strPos);
+                    cell.legends.push_back(cell.text.substr(strPos, newStrPos - strPos));
+                    strPos = newStrPos;
+                } while(strPos != std::string::npos);
+
+                strPos = cell.text.find("\n");
+                if(strPos != std::string::npos) cell.text.resize(strPos);
+                auto keyCodeIt = name2Keycode.find(cell.text);
+                if(keyCodeIt != name2Keycode.end())
+                {
+                    cell.type = KleCell::LAYOUT_KEY;
+                    cell.keyCode = keyCodeIt->second;
+                    cell.legends[0] = "";
+                }
+                else
+                {
+                    cell.type = KleCell::UNKNOWN_KEY;
+                    cell.legends.clear();
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,56 @@
+#include <unicode/uchar.h>
+#include <unicode/unistr.h>
+#include "Counters.hpp"
+#include "Legend.hpp"
+
+namespace keylayout2kle
+{
+
+LegendDecorator::LegendDecorator(const Settings &settings) : settings(settings)
+{
+    UErrorCode biError = U_ZERO_ERROR;
+    bi.reset(icu::BreakIterator::createCharacterInstance(icu::Locale::getDefault(), biError));
+    if(U_FAILURE(biError)) throw Error(std::string("Cannot create a break iterator: ") + u_errorName(biError));
+    Counters::add(&Counters::breakIterators);
+}
+
+UChar32 LegendDecorator::decorate(const std::string &legend, std::string &label)
+{
+    UChar32 nonGraphic = U_SENTINEL;
+    auto it = settings.substitutions.find(legend);
+    if(it != settings.substitutions.end()) Counters::add(&Counters::substitutionHits);
+    icu::UnicodeString us(it != settings.substitutions.end() ? it->second.c_str() : legend.c_str());
+    // Add dotted circle on combining characters
+    if(us.countChar32() == 1)
+    {
+        UChar32 c32 = us.char32At(0);
+        int8_t charCategory = u_charType(c32);
+        if(charCategory == U_NON_SPACING_MARK || charCategory == U_ENCLOSING_MARK
+            || charCategory == U_COMBINING_SPACING_MARK)
+        {
+            us.insert(0, "</span>");
+            us.insert(0, 0x25cc);
+            us.insert(0, "<span class=\"nongraphic\">");
+            uint8_t combiningClass = u_getCombiningClass(c32);
+            // Double diacritic, append another dotted circle
+            if(combiningClass == 233 || combiningClass == 234) us.append(0x25cc);
+        }
+        if(!u_isgraph(c32)) nonGraphic = c32;
+    }
+
+    // Add <span> tags around emojis
+    bi->setText(us);
+    for(int32_t p = bi->first(); p != icu::BreakIterator::DONE;)
+    {
+        int32_t next = bi->next();
+        int32_t n = next == icu::BreakIterator::DONE ? us.length() : next;
+        bool isEmoji = u_stringHasBinaryProperty(us.getBuffer() + p, n - p, UCHAR_RGI_EMOJI);
+        if(isEmoji) label += "<span class=\"emoji\">";
+        us.tempSubString(p, n - p).toUTF8String<std::string>(label);
+        if(isEmoji) label += "</span>";
+        p = next;
+    }
+    return nonGraphic;
+}
+
+}
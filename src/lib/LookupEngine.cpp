@@ -0,0 +1,300 @@
+#include <cstring>
+#include <set>
+#include <tinyxml2.h>
+#include "LookupEngine.hpp"
+
+#define ITERATE_CHILDREN(NODE, VAR, STR) for(const tinyxml2::XMLElement *VAR = NODE->FirstChildElement(STR);\
+        VAR; VAR = VAR->NextSiblingElement(STR))
+
+namespace keylayout2kle
+{
+
+XmlEngine::XmlEngine() : document(new tinyxml2::XMLDocument) {}
+
+XmlEngine::~XmlEngine() {}
+
+std::unique_ptr<XmlEngine> XmlEngine::load(const Source &source)
+{
+    std::unique_ptr<XmlEngine> engine(new XmlEngine);
+    tinyxml2::XMLError xmlError = source.inMemory ? engine->document->Parse(source.content.c_str(),
+            source.content.size()) : engine->document->LoadFile(source.path.c_str());
+    if(xmlError != tinyxml2::XML_SUCCESS || !engine->document->FirstChildElement()) throw Error("Xml parse fail");
+    engine->keyboardNode = engine->document->FirstChildElement();
+    engine->actionsNode = engine->keyboardNode->FirstChildElement("actions");
+    return engine;
+}
+
+std::pair<const char*, bool> XmlEngine::keyOutput(const char *mapName, const char *stateName, uint16_t mapIndex,
+        uint16_t keyCode) const
+{
+    const char *keyAction = nullptr;
+    const tinyxml2::XMLElement *foundKeyMap = nullptr;
+    ITERATE_CHILDREN(keyboardNode, keyMapSet, "keyMapSet")
+    {
+        if(!keyMapSet->Attribute("id", mapName)) continue;
+        ITERATE_CHILDREN(keyMapSet, keyMap, "keyMap")
+        {
+            if(keyMap->IntAttribute("index") != mapIndex) continue;
+            foundKeyMap = keyMap;
+            ITERATE_CHILDREN(keyMap, key, "key")
+            {
+                if(key->IntAttribute("code") == keyCode)
+                {
+                    const char *output = key->Attribute("output");
+                    if(output) return std::make_pair(output, false);
+                    keyAction = key->Attribute("action");
+                    break;
+                }
+            }
+            break;
+        }
+        break;
+    }
+    if(keyAction)
+    {
+        if(actionsNode) ITERATE_CHILDREN(actionsNode, actionSet, "action")
+        {
+            if(!actionSet->Attribute("id", keyAction)) continue;
+            ITERATE_CHILDREN(actionSet, action, "when")
+            {
+                if(!action->Attribute("state", stateName)) continue;
+                const char *output = action->Attribute("output");
+                if(output) return std::make_pair(output, false);
+                const char *nextState = action->Attribute("next");
+                if(nextState) return std::make_pair(nextState, true);
+                break;
+            }
+            break;
+        }
+    }
+    else if(foundKeyMap)
+    {
+        const char *baseMapSet = foundKeyMap->Attribute("baseMapSet");
+        if(baseMapSet)
+        {
+            uint16_t baseIndex = static_cast<uint16_t>(foundKeyMap->IntAttribute("baseIndex"));
+            return keyOutput(baseMapSet, stateName, baseIndex, keyCode);
+        }
+    }
+    return std::make_pair(nullptr, false);
+}
+
+// All the actions with that id are searched, the first when in state none gives the state
+const char *XmlEngine::actionState(const char *actionName) const
+{
+    if(actionsNode) ITERATE_CHILDREN(actionsNode, actionSet, "action")
+    {
+        if(!actionSet->Attribute("id", actionName)) continue;
+        ITERATE_CHILDREN(actionSet, action, "when")
+        {
+            if(!action->Attribute("state", "none")) continue;
+            if(action->Attribute("output")) return nullptr;
+            return action->Attribute("next");
+        }
+    }
+    return nullptr;
+}
+
+std::vector<std::vector<KeyWithLevel>> XmlEngine::findStatePath(const char *mapName, const char *stateName,
+        uint8_t depth, const std::vector<bool> &usedMapIndices) const
+{
+    return findStatePath(mapName, stateName, depth, usedMapIndices, std::unordered_set<std::string>());
+}
+
+std::vector<std::vector<KeyWithLevel>> XmlEngine::findStatePath(const char *mapName, const char *stateName,
+        uint8_t depth, const std::vector<bool> &usedMapIndices, const std::unordered_set<std::string> &forbiddenStates)
+        const
+{
+    std::vector<std::vector<KeyWithLevel>> ret;
+    if(!strcmp(stateName, "none"))
+    {
+        ret.resize(1);
+        return ret;
+    }
+    std::unordered_set<std::string> newForbiddenStates = forbiddenStates;
+    newForbiddenStates.insert(stateName);
+    auto processKeyMap = [this, depth, mapName, stateName, &usedMapIndices, &ret, &forbiddenStates,
+            &newForbiddenStates](const tinyxml2::XMLElement *keyMap, uint16_t mapIndex)
+    {
+        ITERATE_CHILDREN(keyMap, key, "key")
+        {
+            uint16_t keyCode = static_cast<uint16_t>(key->IntAttribute("code"));
+            const char *actionName = key->Attribute("action");
+            if(!actionName) continue;
+            if(depth == 0)
+            {
+                const char *nextState = actionState(actionName);
+                if(nextState && !strcmp(stateName, nextState))
+                {
+                    std::vector<KeyWithLevel> newPath;
+                    newPath.push_back(KeyWithLevel{mapIndex, keyCode});
+                    ret.push_back(newPath);
+                }
+            }
+            else if(actionsNode) ITERATE_CHILDREN(actionsNode, actionSet, "action")
+            {
+                if(!actionSet->Attribute("id", actionName)) continue;
+                ITERATE_CHILDREN(actionSet, action, "when")
+                {
+                    const char *state = action->Attribute("state");
+                    if(!state || !strcmp(state, "none")) continue;
+                    if(forbiddenStates.count(state)) continue;
+                    if(action->Attribute("output")) continue;
+                    if(action->Attribute("next", stateName))
+                    {
+                        std::vector<std::vector<KeyWithLevel>> paths = findStatePath(mapName, state, depth - 1,
+                                usedMapIndices, newForbiddenStates);
+                        for(std::vector<KeyWithLevel> &vec : paths)
+                        {
+                            ret.push_back(std::move(vec));
+                            ret.back().push_back(KeyWithLevel{mapIndex, keyCode});
+                        }
+                    }
+                }
+            }
+        }
+    };
+    ITERATE_CHILDREN(keyboardNode, keyMapSet, "keyMapSet")
+    {
+        if(!keyMapSet->Attribute("id", mapName)) continue;
+        ITERATE_CHILDREN(keyMapSet, keyMap, "keyMap")
+        {
+            uint16_t mapIndex = static_cast<uint16_t>(keyMap->IntAttribute("index"));
+            if(mapIndex >= usedMapIndices.size() || !usedMapIndices[mapIndex]) continue;
+            processKeyMap(keyMap, mapIndex);
+            const char *baseMapSet = keyMap->Attribute("baseMapSet");
+            if(baseMapSet)
+            {
+                int baseIndex = keyMap->IntAttribute("baseIndex");
+                ITERATE_CHILDREN(keyboardNode, baseKeyMapSet, "keyMapSet")
+                {
+                    if(!baseKeyMapSet->Attribute("id", baseMapSet)) continue;
+                    ITERATE_CHILDREN(baseKeyMapSet, baseKeyMap, "keyMap")
+                    {
+                        if(baseKeyMap->IntAttribute("index") != baseIndex) continue;
+                        processKeyMap(baseKeyMap, mapIndex);
+                    }
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+std::pair<const char*, bool> CompiledEngine::keyOutput(const char *mapName, const char *stateName, uint16_t mapIndex,
+        uint16_t keyCode) const
+{
+    std::pair<uint32_t, bool> ret = layout->keyOutput(layout->strings.find(mapName), layout->strings.find(stateName),
+            mapIndex, keyCode);
+    return std::make_pair(layout->strings.str(ret.first), ret.second);
+}
+
+std::vector<std::vector<KeyWithLevel>> CompiledEngine::findStatePath(const char *mapName, const char *stateName,
+        uint8_t depth, const std::vector<bool> &usedMapIndices) const
+{
+    return layout->findStatePath(layout->strings.find(mapName), layout->strings.find(stateName), depth,
+            usedMapIndices);
+}
+
+namespace
+{
+    std::string describe(const char *str)
+    {
+        return str ? '"' + std::string(str) + '"' : std::string("none");
+    }
+
+    std::string describe(const std::vector<std::vector<KeyWithLevel>> &paths)
+    {
+        std::string ret = std::to_string(paths.size()) + " paths";
+        for(size_t i = 0; i < paths.size() && i < 4; i++)
+        {
+            ret += i ? ", " : ": ";
+            for(size_t j = 0; j < paths[i].size(); j++) ret += (j ? " " : "") + std::to_string(paths[i][j].mapIndex)
+                    + "/" + std::to_string(paths[i][j].keyCode);
+        }
+        return paths.size() > 4 ? ret + "..." : ret;
+    }
+
+    bool samePaths(const std::vector<std::vector<KeyWithLevel>> &a, const std::vector<std::vector<KeyWithLevel>> &b)
+    {
+        if(a.size() != b.size()) return false;
+        for(size_t i = 0; i < a.size(); i++)
+        {
+            if(a[i].size() != b[i].size()) return false;
+            for(size_t j = 0; j < a[i].size(); j++) if(a[i][j].mapIndex != b[i][j].mapIndex
+                    || a[i][j].keyCode != b[i][j].keyCode) return false;
+        }
+        return true;
+    }
+}
+
+size_t verifyEngines(const LookupEngine &reference, const LookupEngine &candidate, const CompiledLayout &layout,
+        const Settings &settings, std::ostream &report)
+{
+    // Only the first mismatches are written
+    const size_t maxReported = 20;
+    size_t numQueries = 0, numMismatches = 0;
+    auto mismatch = [&](const std::string &message)
+    {
+        if(numMismatches++ < maxReported) report << message << "\n";
+    };
+
+    // Every state named by the layout or the settings, in a stable order
+    std::vector<std::string> states;
+    std::set<std::string> seenStates;
+    auto addState = [&](const char *state)
+    {
+        if(state && seenStates.insert(state).second) states.push_back(state);
+    };
+    addState("none");
+    for(const CompiledWhen &when : layout.whens)
+    {
+        addState(layout.strings.str(when.state));
+        addState(layout.strings.str(when.next));
+    }
+    for(const StateSettings &state : settings.states) addState(state.state.c_str());
+    std::set<uint16_t> mapIndices, keyCodes;
+    for(const CompiledKeyMap &keyMap : layout.keyMaps) mapIndices.insert(static_cast<uint16_t>(keyMap.index));
+    for(const CompiledKey &key : layout.keys) keyCodes.insert(static_cast<uint16_t>(key.code));
+
+    for(const CompiledKeyMapSet &keyMapSet : layout.keyMapSets)
+    {
+        const char *mapName = layout.strings.str(keyMapSet.id);
+        if(!mapName) continue;
+        for(uint16_t mapIndex : mapIndices) for(uint16_t keyCode : keyCodes) for(const std::string &state : states)
+        {
+            numQueries++;
+            std::pair<const char*, bool> expected = reference.keyOutput(mapName, state.c_str(), mapIndex, keyCode);
+            std::pair<const char*, bool> actual = candidate.keyOutput(mapName, state.c_str(), mapIndex, keyCode);
+            bool same = expected.second == actual.second && (expected.first && actual.first
+                    ? !strcmp(expected.first, actual.first) : expected.first == actual.first);
+            if(!same) mismatch(std::string("keyOutput(") + mapName + ", " + std::to_string(mapIndex) + ", "
+                    + std::to_string(keyCode) + ", " + state + "): reference " + describe(expected.first)
+                    + (expected.second ? " (dead)" : "") + ", candidate " + describe(actual.first)
+                    + (actual.second ? " (dead)" : ""));
+        }
+    }
+
+    // Paths are searched at increasing depths until some are found, as by the converter
+    for(const std::string &mapName : settings.keyMapSets) for(const StateSettings &state : settings.states)
+    {
+        for(uint8_t depth = 0; depth < 5; depth++)
+        {
+            numQueries++;
+            std::vector<std::vector<KeyWithLevel>> expected = reference.findStatePath(mapName.c_str(),
+                    state.state.c_str(), depth, settings.usedMapIndices);
+            std::vector<std::vector<KeyWithLevel>> actual = candidate.findStatePath(mapName.c_str(),
+                    state.state.c_str(), depth, settings.usedMapIndices);
+            if(!samePaths(expected, actual)) mismatch("findStatePath(" + mapName + ", " + state.state + ", "
+                    + std::to_string(depth) + "): reference " + describe(expected) + ", candidate "
+                    + describe(actual));
+            if(!expected.empty() || !actual.empty()) break;
+        }
+    }
+
+    if(numMismatches > maxReported) report << "...\n";
+    report << numQueries << " queries, " << numMismatches << " mismatches" << std::endl;
+    return numMismatches;
+}
+
+}
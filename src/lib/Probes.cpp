@@ -0,0 +1,11 @@
+#include "Probes.hpp"
+
+#ifdef HAVE_SDT
+// The semaphores are found by tracers in the .probes section, and by the probes' notes by their C names
+#define PROBE_DEFINE_SEMAPHORE(name) \
+        unsigned short keylayout2kle_##name##_semaphore __attribute__((section(".probes"))) = 0;
+extern "C"
+{
+    PROBE_SEMAPHORES(PROBE_DEFINE_SEMAPHORE)
+}
+#endif
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdio>
+#include "Profile.hpp"
+
+namespace keylayout2kle
+{
+
+namespace
+{
+    void sortByWall(std::vector<Profile::Entry> &entries)
+    {
+        std::stable_sort(entries.begin(), entries.end(), [](const Profile::Entry &a, const Profile::Entry &b)
+        {
+            return a.time.wall > b.time.wall;
+        });
+    }
+
+    // Pages run concurrently and share the process peak RSS, so it is only written for phases, with a rssTitle
+    void printTable(std::ostream &out, const char *title, const std::vector<Profile::Entry> &entries,
+            const char *rssTitle = nullptr)
+    {
+        bool allocations = Allocations::counted();
+        char line[200];
+        int size = snprintf(line, sizeof(line), "%-40s %12s %12s %8s", title, "wall (ms)", "cpu (ms)", "count");
+        if(allocations) size += snprintf(line + size, sizeof(line) - size, " %10s %14s", "allocs", "alloc (KiB)");
+        if(rssTitle) snprintf(line + size, sizeof(line) - size, " %16s", rssTitle);
+        out << line << "\n";
+        for(const Profile::Entry &entry : entries)
+        {
+            size = snprintf(line, sizeof(line), "    %-36.36s %12.3f %12.3f %8zu", entry.name.c_str(), entry.time.wall,
+                    entry.time.cpu, entry.count);
+            if(allocations) size += snprintf(line + size, sizeof(line) - size, " %10llu %14llu",
+                    static_cast<unsigned long long>(entry.time.allocations),
+                    static_cast<unsigned long long>(entry.time.allocatedBytes / 1024));
+            if(rssTitle) snprintf(line + size, sizeof(line) - size, " %16zu", entry.peakRss);
+            out << line << "\n";
+        }
+    }
+
+    nlohmann::json entriesToJson(const std::vector<Profile::Entry> &entries, const char *rssKey = nullptr)
+    {
+        nlohmann::json ret = nlohmann::json::array();
+        for(const Profile::Entry &entry : entries)
+        {
+            nlohmann::json entryJson = {{"name", entry.name}, {"wallMs", entry.time.wall}, {"cpuMs", entry.time.cpu},
+                    {"count", entry.count}};
+            if(rssKey) entryJson[rssKey] = entry.peakRss;
+            if(Allocations::counted())
+            {
+                entryJson["allocations"] = entry.time.allocations;
+                entryJson["allocatedBytes"] = entry.time.allocatedBytes;
+            }
+            ret.push_back(std::move(entryJson));
+        }
+        return ret;
+    }
+}
+
+void Profile::add(const std::string &phase, const Timing &time)
+{
+    size_t rss = peakRss();
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = phaseEntries[phase];
+    entry.name = phase;
+    entry.time += time;
+    entry.count++;
+    entry.peakRss = std::max(entry.peakRss, rss);
+}
+
+void Profile::addPage(uint32_t page, const std::string &state, const Timing &time)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry entry;
+    entry.name = std::to_string(page) + " " + state;
+    entry.time = time;
+    entry.count = 1;
+    pageEntries.push_back(std::move(entry));
+}
+
+std::vector<Profile::Entry> Profile::phases() const
+{
+    std::vector<Entry> ret;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(const std::pair<const std::string, Entry> &entry : phaseEntries) ret.push_back(entry.second);
+    }
+    // Ties in the order of the names, the map has none
+    std::sort(ret.begin(), ret.end(), [](const Entry &a, const Entry &b) {return a.name < b.name;});
+    sortByWall(ret);
+    return ret;
+}
+
+std::vector<Profile::Entry> Profile::pages() const
+{
+    std::vector<Entry> ret;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ret = pageEntries;
+    }
+    sortByWall(ret);
+    return ret;
+}
+
+void Profile::print(std::ostream &out) const
+{
+    printTable(out, "Phase", phases(), "peak rss (KiB)");
+    std::vector<Entry> pageList = pages();
+    if(!pageList.empty()) printTable(out, "Page", pageList);
+    out.flush();
+}
+
+nlohmann::json Profile::toJson() const
+{
+    return {{"phases", entriesToJson(phases(), "peakRssKiB")}, {"pages", entriesToJson(pages())}};
+}
+
+}
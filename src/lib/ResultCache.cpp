@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+#include "BuildId.hpp"
+#include "ResultCache.hpp"
+#include "Util.hpp"
+
+namespace keylayout2kle
+{
+
+// Bump when the cache format changes. Builds are told apart by the hash of the library sources, generated by
+// cmake/BuildId.cmake, so a build whose output may differ does not read the outputs of another one.
+static const char RESULT_CACHE_VERSION[] = "keylayout2kle result cache 1 " KEYLAYOUT2KLE_BUILD_ID;
+
+ResultCache::ResultCache(const std::string &dir, uint64_t maxSize) : dir(dir), maxSize(maxSize)
+{
+    if(!makeDirectory(dir)) throw Error("Cannot create directory " + dir);
+}
+
+Hash128 ResultCache::key(const std::vector<const std::string*> &inputs, const std::string &options)
+{
+    Hash128 ret = Hash128::make(RESULT_CACHE_VERSION, sizeof(RESULT_CACHE_VERSION));
+    for(const std::string *input : inputs) ret = ret.combine(Hash128::make(*input));
+    return ret.combine(Hash128::make(options));
+}
+
+std::string ResultCache::path(const Hash128 &key) const
+{
+    return dir + "/" + key.hex();
+}
+
+bool ResultCache::fetch(const Hash128 &key, std::ostream &out) const
+{
+    std::string filePath = path(key);
+    std::ifstream file(filePath, std::ios::binary);
+    if(!file) return false;
+    out << file.rdbuf();
+#ifndef _WIN32
+    // The modification time is the last use
+    utime(filePath.c_str(), nullptr);
+#endif
+    return !!out;
+}
+
+std::string ResultCache::pendingPath(const Hash128 &key) const
+{
+    // Unique to this call, several processes and threads can miss the same key concurrently
+    static std::atomic<unsigned> counter(0);
+    return path(key) + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+}
+
+void ResultCache::commit(const Hash128 &key, const std::string &pendingPath)
+{
+    // The output appears complete or not at all. A concurrent commit of the same key writes the same output.
+    if(rename(pendingPath.c_str(), path(key).c_str()))
+    {
+        remove(pendingPath.c_str());
+        throw Error("Cannot write " + path(key));
+    }
+    evict();
+}
+
+void ResultCache::evict() const
+{
+#ifndef _WIN32
+    struct Entry
+    {
+        std::string path;
+        uint64_t size;
+        time_t lastUse;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    DIR *d = opendir(dir.c_str());
+    if(!d) return;
+    while(dirent *entry = readdir(d))
+    {
+        std::string name = entry->d_name;
+        // Only outputs, not the pending ones nor foreign files
+        if(name.size() != 32 || name.find_first_not_of("0123456789abcdef") != std::string::npos) continue;
+        struct stat info;
+        std::string entryPath = dir + "/" + name;
+        if(stat(entryPath.c_str(), &info)) continue;
+        entries.push_back(Entry{entryPath, static_cast<uint64_t>(info.st_size), info.st_mtime});
+        totalSize += static_cast<uint64_t>(info.st_size);
+    }
+    closedir(d);
+    if(totalSize <= maxSize) return;
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+    {
+        return a.lastUse < b.lastUse;
+    });
+    for(const Entry &entry : entries)
+    {
+        if(totalSize <= maxSize) break;
+        if(!remove(entry.path.c_str())) totalSize -= entry.size;
+    }
+#endif
+}
+
+}
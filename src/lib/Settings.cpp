@@ -0,0 +1,184 @@
+#include <cmath>
+#include <limits>
+#include <unicode/unistr.h>
+#include "nlohmann/json.hpp"
+#include "StrHash.hpp"
+#include "Settings.hpp"
+
+namespace keylayout2kle
+{
+
+bool LegendSettings::merges(const std::string &legend0, const std::string &legend1) const
+{
+    switch(mergeType)
+    {
+        case SAME:
+            return legend0 == legend1;
+        case UPPERCASE:
+        {
+            icu::UnicodeString str0(legend0.c_str());
+            icu::UnicodeString str1(legend1.c_str());
+            icu::UnicodeString str0Down = str0; str0Down.toLower();
+            icu::UnicodeString str1Up = str1; str1Up.toUpper();
+            return !str0.compare(str1) || !str0Down.compare(str1) || !str0.compare(str1Up);
+        }
+        case LOWERCASE:
+        {
+            icu::UnicodeString str0(legend0.c_str());
+            icu::UnicodeString str1(legend1.c_str());
+            icu::UnicodeString str0Up = str0; str0Up.toUpper();
+            icu::UnicodeString str1Down = str1; str1Down.toLower();
+            return !str0.compare(str1) || !str0Up.compare(str1) || !str0.compare(str1Down);
+        }
+        default:
+            return false;
+    }
+}
+
+namespace
+{
+    // get<T> silently wraps numbers that do not fit in T
+    template<typename T> T getIndex(const nlohmann::json &json, const std::string &what)
+    {
+        double value = json.is_number() ? json.get<double>() : -1.;
+        if(value < 0. || value > std::numeric_limits<T>::max() || value != std::floor(value))
+                throw Error(what + " must be an integer from 0 to " + std::to_string(std::numeric_limits<T>::max()));
+        return static_cast<T>(value);
+    }
+}
+
+std::shared_ptr<const Settings> Settings::load(const Source &source, Timing *parseTime, Timing *interpretTime)
+{
+    std::shared_ptr<Settings> ret = std::make_shared<Settings>();
+    Settings &s = *ret;
+    nlohmann::json settings;
+    Stopwatch stopwatch;
+    std::string content = source.read();
+    s.contentHash = fnv1a(content.data(), content.size());
+    try
+    {
+        settings = nlohmann::json::parse(content);
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        throw Error(std::string("Settings parse fail: ") + e.what());
+    }
+    if(parseTime) *parseTime = stopwatch.elapsed();
+    stopwatch = Stopwatch();
+    try
+    {
+        if(!settings.contains("keyMapSet")) throw Error("Settings does not contain keyMapSet. Add a \"keyMapSet\":X "
+                "where X is a keyMapSet's node id attribute");
+        if(settings.at("keyMapSet").is_array())
+                s.keyMapSets = settings.at("keyMapSet").get<std::vector<std::string>>();
+        else s.keyMapSets.push_back(settings.at("keyMapSet").get<std::string>());
+        if(s.keyMapSets.empty()) throw Error("Settings keyMapSet is an empty array");
+        s.keyMapSet = s.keyMapSets.front();
+        if(!settings.contains("legends") || !settings.at("legends").size()) throw Error("Settings does not contain a "
+                "non-empty legends array");
+        size_t numMaps = settings.at("legends").size();
+        s.legends.reserve(numMaps);
+        for(size_t i = 0; i < numMaps; i++)
+        {
+            const nlohmann::json &mapJson = settings.at("legends").at(i);
+            s.legends.emplace_back();
+            LegendSettings &map = s.legends.back();
+            if(!mapJson.contains("place"))
+                    throw Error(std::string("maps[") + std::to_string(i) + "] does not contain a place");
+            std::string name = "maps[" + std::to_string(i) + "]";
+            map.place = getIndex<uint16_t>(mapJson.at("place"), name + ".place");
+            if(map.place == std::numeric_limits<uint16_t>::max()) throw Error(name + ".place is too large");
+            if(mapJson.contains("merge"))
+            {
+                map.mergeType = LegendSettings::SAME;
+                map.merge[0] = getIndex<uint16_t>(mapJson.at("merge").at(0), name + ".merge[0]");
+                map.merge[1] = getIndex<uint16_t>(mapJson.at("merge").at(1), name + ".merge[1]");
+                if(mapJson.contains("mergeRule"))
+                {
+                    std::string mergeRule = mapJson.at("mergeRule").get<std::string>();
+                    switch(StrHash64::make(mergeRule))
+                    {
+                        case "uppercase"_hash64:
+                            map.mergeType = LegendSettings::UPPERCASE;
+                            break;
+                        case "lowercase"_hash64:
+                            map.mergeType = LegendSettings::LOWERCASE;
+                            break;
+                        default:
+                            throw Error(std::string("maps[") + std::to_string(i) + "]: unknown merge type "
+                                    + mergeRule);
+                    }
+                }
+            }
+            if(map.mergeType == LegendSettings::NO)
+            {
+                if(!mapJson.contains("index"))
+                        throw Error(std::string("maps[") + std::to_string(i) + "] does not contain an index");
+                map.index = getIndex<uint16_t>(mapJson.at("index"), name + ".index");
+            }
+            s.numLegends = std::max<uint16_t>(s.numLegends, map.place + 1);
+            if(mapJson.contains("color")) map.color = mapJson.at("color").get<std::string>();
+        }
+        // Merged legends are read from places that must exist
+        s.placesUsed.resize(s.numLegends);
+        for(size_t i = 0; i < numMaps; i++)
+        {
+            const LegendSettings &map = s.legends[i];
+            s.placesUsed[map.place] = true;
+            if(map.mergeType != LegendSettings::NO && (map.merge[0] >= s.numLegends || map.merge[1] >= s.numLegends))
+                    throw Error("maps[" + std::to_string(i) + "]: merge places must be below the number of places");
+        }
+        size_t numModifiers = settings.contains("modifiers") ? settings.at("modifiers").size() : 0;
+        for(size_t i = 0; i < numModifiers; i++)
+        {
+            const nlohmann::json &modifierJson = settings.at("modifiers").at(i);
+            uint16_t index = getIndex<uint16_t>(modifierJson.at("index"),
+                    "modifiers[" + std::to_string(i) + "].index");
+            if(index >= s.modifiers.size()) s.modifiers.resize(index + 1);
+            s.modifiers[index].isUsed = true;
+            s.modifiers[index].prefix = modifierJson.at("prefix").get<std::string>();
+        }
+        for(const ModifierSettings &modifier : s.modifiers) s.usedMapIndices.push_back(modifier.isUsed);
+        if(!settings.contains("states") || !settings.at("states").size()) throw Error("Settings does not contain a "
+                "non-empty states array");
+        size_t numStates = settings.at("states").size();
+        s.states.reserve(numStates);
+        for(size_t i = 0; i < numStates; i++)
+        {
+            const nlohmann::json &stateJson = settings.at("states").at(i);
+            s.states.emplace_back();
+            StateSettings &state = s.states.back();
+            if(!stateJson.contains("state"))
+                    throw Error(std::string("state[") + std::to_string(i) + "] does not contain a state");
+            state.state = stateJson.at("state").get<std::string>();
+            if(stateJson.contains("display")) state.display = stateJson.at("display").get<std::string>();
+            else state.display = state.state;
+            if(stateJson.contains("legend")) state.legend = stateJson.at("legend").get<std::string>();
+            else state.legend = state.state;
+            if(stateJson.contains("show")) state.show = stateJson.at("show").get<bool>();
+            else state.show = true;
+        }
+        if(settings.contains("substitutions"))
+                s.substitutions = settings.at("substitutions").get<std::unordered_map<std::string, std::string>>();
+        if(settings.contains("stateDy")) s.stateDy = settings.at("stateDy").get<float>();
+        for(size_t i = 0; i < s.states.size(); i++) s.stateLookup.emplace(s.states[i].state, i);
+        if(settings.contains("index"))
+        {
+            const nlohmann::json &indexJson = settings.at("index");
+            s.hasIndex = true;
+            if(!indexJson.contains("width")) throw Error("index does not contain width");
+            s.indexWidth = indexJson.at("width").get<float>();
+            if(indexJson.contains("numColumns"))
+                    s.indexNumColumns = getIndex<uint16_t>(indexJson.at("numColumns"), "index.numColumns");
+            if(!s.indexNumColumns) throw Error("index numColumns must not be 0");
+        }
+    }
+    catch(const nlohmann::json::exception &e)
+    {
+        throw Error(std::string("Invalid settings: ") + e.what());
+    }
+    if(interpretTime) *interpretTime = stopwatch.elapsed();
+    return ret;
+}
+
+}
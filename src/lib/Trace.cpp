@@ -0,0 +1,34 @@
+#include "Trace.hpp"
+
+namespace keylayout2kle
+{
+
+void Trace::add(const std::string &name, const char *category, Clock::time_point spanStart,
+        Clock::time_point spanEnd, nlohmann::json args)
+{
+    // Timestamps and durations are in µs
+    double ts = std::chrono::duration<double, std::micro>(spanStart - start).count();
+    double dur = std::chrono::duration<double, std::micro>(spanEnd - spanStart).count();
+    nlohmann::json event = {{"name", name}, {"cat", category}, {"ph", "X"}, {"ts", ts}, {"dur", dur}, {"pid", 1}};
+    if(args.type() != nlohmann::json::value_t::null) event["args"] = std::move(args);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = threadIds.emplace(std::this_thread::get_id(), static_cast<uint32_t>(threadIds.size() + 1)).first;
+    event["tid"] = it->second;
+    events.push_back(std::move(event));
+}
+
+void Trace::write(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nlohmann::json traceEvents = nlohmann::json::array();
+    for(const std::pair<const std::thread::id, uint32_t> &thread : threadIds)
+    {
+        std::string threadName = thread.second == 1 ? "main" : "worker " + std::to_string(thread.second - 1);
+        traceEvents.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", thread.second},
+                {"args", {{"name", threadName}}}});
+    }
+    for(const nlohmann::json &event : events) traceEvents.push_back(event);
+    out << nlohmann::json({{"traceEvents", std::move(traceEvents)}, {"displayTimeUnit", "ms"}}) << std::endl;
+}
+
+}
@@ -0,0 +1,74 @@
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#endif
+#include "Util.hpp"
+
+namespace keylayout2kle
+{
+
+std::string Source::read() const
+{
+    if(inMemory) return content;
+    std::ifstream file(path, std::ios::binary);
+    if(!file) throw Error("Cannot open " + path);
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+double threadCpuMs()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec time;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time)) return 0.;
+    return time.tv_sec * 1000. + time.tv_nsec / 1000000.;
+#else
+    return 0.;
+#endif
+}
+
+size_t currentRss()
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+#else
+    return 0;
+#endif
+}
+
+size_t peakRss()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<size_t>(usage.ru_maxrss);
+#endif
+#else
+    return 0;
+#endif
+}
+
+bool makeDirectory(const std::string &path)
+{
+#ifndef _WIN32
+    return !mkdir(path.c_str(), 0755) || errno == EEXIST;
+#else
+    return !_mkdir(path.c_str()) || errno == EEXIST;
+#endif
+}
+
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Sends jobs to a keylayout2kle daemon started with --serve <socket>.
+
+    keylayout2kle_client.py <socket> <keylayout> <kle json> <settings json> [options] [-o output]
+    keylayout2kle_client.py <socket> --job '<job json>'...
+    keylayout2kle_client.py <socket> --stats | --shutdown
+
+Options are the command line ones, such as --min-page 2. Paths are sent as absolute paths. Without -o, the output is
+printed. Warnings are printed to stderr.
+"""
+
+import json
+import os
+import socket
+import sys
+
+VALUE_OPTIONS = {"min-page", "max-page", "shard", "shard-mode", "split-output", "compress"}
+
+
+def request(sock_file, sock, job):
+    sock.sendall((json.dumps(job) + "\n").encode())
+    line = sock_file.readline()
+    if not line:
+        sys.exit("The server closed the connection")
+    return json.loads(line)
+
+
+def make_job(args):
+    if len(args) < 3:
+        sys.exit(__doc__)
+    job = {"keylayout": os.path.abspath(args[0]), "kle": os.path.abspath(args[1]),
+           "settings": os.path.abspath(args[2]), "options": {}}
+    i = 3
+    while i < len(args):
+        arg = args[i]
+        if arg == "-o" and i + 1 < len(args):
+            job["output"] = os.path.abspath(args[i + 1])
+            i += 2
+        elif arg.startswith("--") and arg[2:] in VALUE_OPTIONS and i + 1 < len(args):
+            value = args[i + 1]
+            job["options"][arg[2:]] = os.path.abspath(value) if arg == "--split-output" else value
+            i += 2
+        elif arg.startswith("--"):
+            job["options"][arg[2:]] = True
+            i += 1
+        else:
+            sys.exit("Unexpected argument " + arg)
+    return job
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    args = sys.argv[2:]
+    if args[0] == "--stats":
+        jobs = [{"command": "stats"}]
+    elif args[0] == "--shutdown":
+        jobs = [{"command": "shutdown"}]
+    elif args[0] == "--job":
+        jobs = [json.loads(job) for job in args[1:]]
+    else:
+        jobs = [make_job(args)]
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(sys.argv[1])
+    sock_file = sock.makefile("r", encoding="utf-8")
+    status = 0
+    for job in jobs:
+        response = request(sock_file, sock, job)
+        for warning in response.get("warnings", []):
+            print(warning, file=sys.stderr)
+        if not response.get("ok"):
+            print(response.get("error"), file=sys.stderr)
+            status = 1
+        elif "output" in response:
+            sys.stdout.write(response["output"])
+        elif "command" in job:
+            print(json.dumps(response))
+    sock.close()
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())